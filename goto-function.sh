@@ -11,8 +11,18 @@ goto() {
     # Get the directory where this script lives
     local script_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
     
+    # A query that is not a directory jumps straight to the best match,
+    # which the binary prints instead of opening the navigator
+    if [ -n "$1" ] && [ ! -d "$1" ]; then
+        local target
+        target=$("$script_dir/bin/goto" "$@") || return
+        rm -f "$tempfile"
+        cd "$target" && pwd
+        return
+    fi
+    
     # Run the goto binary
-    "$script_dir/bin/goto"
+    "$script_dir/bin/goto" "$@"
     
     # If user pressed 'o', cd to that directory
     if [ -f "$tempfile" ]; then
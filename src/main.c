@@ -1,4 +1,7 @@
 //goto - Fixed version with security improvements and bug fixes
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #ifndef USE_NERD_FONTS
 #define USE_NERD_FONTS
 #endif
@@ -17,9 +20,60 @@
 #include <signal.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <regex.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#endif
 
 #define MAX_PATH 4096
-#define MAX_ITEMS 1024
+#define ENTRIES_INITIAL_CAP 64
+#define NAMES_INITIAL_CAP 4096
+#define GETDENTS_BUF_SIZE (128 * 1024)
+#define SCAN_SLACK 16              // readable bytes past name/path arenas for vector loads
+#define STAT_PARALLEL_MIN 2048     // below this many entries stat serially
+#define STAT_CHUNK 256             // entries a stat worker claims at a time
+#define STAT_WORKERS_MAX 64
+#define LAZY_PREFETCH_ROWS 32      // rows stat'ed beyond the visible window
+#define LAZY_PARALLEL_MIN 32       // window stats worth fanning out
+#define LOAD_FIRST_CHUNK (32 * 1024)  // getdents bytes read before first paint
+#define LOAD_SYNC_BUDGET_MS 40     // after this, the rest loads in the background
+#define BACKGROUND_TICK_MS 50      // input timeout while background work runs
+#define FRAME_MS 16                // minimum gap between redraws while keys stream in
+#define SORT_BACKGROUND_MIN (256 * 1024)  // rows above which sorting finishes off-thread
+#define SORT_WINDOW_ROWS 256       // rows sorted up front at each end of the order
+#define SORT_PIECES_MAX 64
+#define LISTING_CACHE_SLOTS 8
+#define LISTING_CACHE_MAX_ENTRIES (1 << 21)   // across all cached listings
+#define DU_MEMO_MAX_DIRS (1 << 20)  // directories remembered across walks
+#define PREFETCH_IDLE_MS 300       // cursor rest on a directory before prefetching it
+#define PREFETCH_MAX_ENTRIES 65536 // bigger directories are left to load_directory
+#define PREFETCH_NICE 10
+#define PREVIEW_BYTES (64 * 1024)  // head of a file the preview pane reads
+#define PREVIEW_LINES 256          // lines kept per preview
+#define PREVIEW_LINE_MAX 512       // bytes kept per line
+#define PREVIEW_DIR_MAX 4096       // children read for a directory preview
+#define PREVIEW_SNIFF 8192         // a NUL in here shows a file as hex
+#define PREVIEW_SLOTS 16           // previews remembered (LRU)
+#define PREVIEW_IDLE_MS 40         // cursor rest before a preview is built
+#define PREVIEW_TICK_MS 10         // input timeout while one is being built
+#define PREVIEW_JOBS_MAX 4         // preview threads alive, abandoned ones included
+#define PREVIEW_MIN_COLS 60        // narrower terminals get no pane
+#define WATCH_COALESCE_MS 150      // batch inotify deltas into one redraw
+#define WATCH_PENDING_MAX 16384    // beyond this many names, just re-read
+#define FRECENCY_VISIT 1           // frecency weight of entering a directory
+#define FRECENCY_EXIT 4            // ... and of leaving goto in it
 #define QUOTE_BUF_SIZE (MAX_PATH * 4 + 4)
 
 #define ICON_FOLDER "\ue5ff"
@@ -91,7 +145,8 @@ typedef enum {
     SORT_NAME = 0,
     SORT_SIZE,
     SORT_TIME,
-    SORT_EXT
+    SORT_EXT,
+    SORT_DU          // directories by recursive disk usage, files by size
 } SortMode;
 
 typedef enum {
@@ -101,32 +156,118 @@ typedef enum {
     FILTER_CONTAINS
 } FilterMode;
 
+// How a row is drawn, worked out once per entry (META_STYLE): an index
+// into g_icons, one into g_paint, and the size column ready to print.
 typedef struct {
-    char name[256];
-    char full_path[MAX_PATH];
-    mode_t mode;
-    off_t size;
-    time_t mtime;
-    int is_dir;
-    int is_hidden;
-} FileItem;
+    uint8_t icon;
+    uint8_t paint;
+    char size[8];           // "" when there is no size to show
+} RowStyle;
+
+// Directory entries stored column-wise. Names live back to back in one
+// string arena; the per-entry columns only hold what sorting, filtering
+// and drawing actually read. Full paths are built on demand from cwd.
+typedef struct {
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+    uint32_t *name_off;
+    uint64_t *fold;         // first 8 name bytes lowercased, big-endian: sort key
+    uint16_t *ext_off;      // extension offset within the name ("" if none)
+    mode_t *mode;
+    off_t *size;
+    time_t *mtime;
+    int64_t *du;            // directories: recursive allocated bytes (META_DU)
+    unsigned char *is_dir;
+    unsigned char *is_hidden;
+    unsigned char *meta;    // META_* bits: which of the columns above are valid
+    RowStyle *style;        // META_STYLE, filled in when the row is first drawn
+    int count;
+    int capacity;
+    uint32_t *index;        // name -> entry hash (entry + 1, 0 = empty), built on demand
+    uint32_t index_cap;     // power of two
+    uint32_t index_used;
+    int index_valid;
+    int gone;               // entries flagged META_GONE
+} DirListing;
+
+// Metadata bits. A column is only trusted when its bit is set in meta[i].
+#define META_TYPE  0x01   // is_dir (from d_type or stat)
+#define META_SIZE  0x02   // mode and size
+#define META_MTIME 0x04   // mtime
+#define META_DU    0x08   // du, filled in by the disk-usage walker
+#define META_STYLE 0x10   // style, from the columns above; cleared when they change
+#define META_DIRTY 0x40   // queued for re-sorting by a live patch
+#define META_GONE  0x80   // removed from disk; kept only until the next load
+
+struct DirLoader;
+struct SortJob;
+struct Prefetch;
+struct DuJob;
+struct PreviewJob;
 
+// What draw_ui last left on the screen, so a frame only rewrites the rows
+// whose content changed.
 typedef struct {
-    FileItem items[MAX_ITEMS];
+    uint64_t *row;       // per list row: hash of what is drawn there, 0 = unknown
+    int rows;
+    int cols;
+    int scroll_offset;
+    dev_t dev;           // directory it was drawn for
+    ino_t ino;
+    uint64_t pane;       // hash of what the preview pane shows, 0 = unknown
+} ScreenShadow;
+
+typedef struct {
+    DirListing entries;  // reused across loads; reset is O(1)
+    int dir_fd;          // open handle on cwd, entries are stat'ed relative to it
+    dev_t dir_dev;       // identity and mtime of cwd when it was read
+    ino_t dir_ino;
+    int64_t dir_mtime_ns;
+    int watch_fd;        // inotify instance, or -1
+    int watch_wd;        // watch on cwd, or -1
+    DirListing watch_pending;    // names touched since the last patch
+    struct timespec watch_due;   // when to apply watch_pending
+    int watch_reload;            // event queue overflowed: re-read instead
+    int lazy_meta;       // GOTO_LAZY_STAT: stat only rows that get drawn
+    uint32_t *order;     // display order, indices into entries
+    int order_cap;
     int count;
     int selected;
     int scroll_offset;
     char cwd[MAX_PATH];
     int show_hidden;
+    int show_ignored;    // `/` and `F` keep what ignore files exclude
 
     SortMode sort_mode;
     int sort_reverse;
 
     FilterMode filter_mode;
     char filter_text[256];
+    int filter_typing;          // fc is open: keys edit filter_text live
+    struct FilterLevel *filter_levels;  // rows before each typed character
+    int filter_depth;
 
     char pending_prefix;
 
+    struct DirLoader *loader;   // in-flight background load, or NULL
+    struct SortJob *sorter;     // in-flight background sort, or NULL
+    struct Prefetch *prefetch;  // in-flight read of the highlighted directory
+    char prefetch_name[256];    // directory the cursor rests on ("" if none)
+    struct timespec prefetch_since;
+    int prefetch_started;       // prefetch_name was already tried
+    struct DuJob *du;           // in-flight disk-usage walk (SORT_DU), or NULL
+    int preview_on;             // `i`: the right half of the screen previews the selection
+    struct PreviewJob *preview; // in-flight preview build, or NULL
+    uint64_t preview_want;      // key hash of the entry to preview, 0 if none
+    struct timespec preview_since;
+    int preview_started;        // preview_want was already looked up or built
+    char pending_select[256];   // entry to select once the loader delivers it
+
+    ScreenShadow shown;
+    int repaint;                // next draw_ui repaints the whole screen
+    struct timespec drawn;      // when draw_ui last refreshed the terminal
+
 } FileList;
 
 // Global state for cleanup
@@ -163,6 +304,274 @@ static void register_temp_file(const char *path) {
     }
 }
 
+// ---- listing store ----------------------------------------------------
+
+// Drop all entries but keep the allocations for the next load.
+static void listing_reset(DirListing *d) {
+    d->count = 0;
+    d->names_len = 0;
+    d->index_valid = 0;
+    d->gone = 0;
+}
+
+static uint32_t name_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static void index_insert(DirListing *d, uint32_t i) {
+    uint32_t mask = d->index_cap - 1;
+    uint32_t slot = name_hash(d->names + d->name_off[i]) & mask;
+    while (d->index[slot]) slot = (slot + 1) & mask;
+    d->index[slot] = i + 1;
+    d->index_used++;
+}
+
+// (Re)build the name index with room for `need` entries. Entries flagged
+// META_GONE stay in it, so a late loader batch can still tell them apart.
+static int index_rebuild(DirListing *d, int need) {
+    uint32_t cap = 64;
+    while (cap < (uint32_t)need * 2) cap *= 2;
+    if (cap != d->index_cap) {
+        uint32_t *index = realloc(d->index, cap * sizeof(*index));
+        if (!index) { d->index_valid = 0; return -1; }
+        d->index = index;
+        d->index_cap = cap;
+    }
+    memset(d->index, 0, d->index_cap * sizeof(*d->index));
+    d->index_used = 0;
+    for (int i = 0; i < d->count; i++) index_insert(d, (uint32_t)i);
+    d->index_valid = 1;
+    return 0;
+}
+
+static int listing_grow(DirListing *d, int need) {
+    if (need <= d->capacity) return 0;
+    int cap = d->capacity ? d->capacity : ENTRIES_INITIAL_CAP;
+    while (cap < need) {
+        if (cap > INT_MAX / 2) { errno = ENOMEM; return -1; }
+        cap *= 2;
+    }
+    uint32_t *name_off = realloc(d->name_off, (size_t)cap * sizeof(*name_off));
+    if (!name_off) return -1;
+    d->name_off = name_off;
+    uint64_t *fold = realloc(d->fold, (size_t)cap * sizeof(*fold));
+    if (!fold) return -1;
+    d->fold = fold;
+    uint16_t *ext_off = realloc(d->ext_off, (size_t)cap * sizeof(*ext_off));
+    if (!ext_off) return -1;
+    d->ext_off = ext_off;
+    mode_t *mode = realloc(d->mode, (size_t)cap * sizeof(*mode));
+    if (!mode) return -1;
+    d->mode = mode;
+    off_t *size = realloc(d->size, (size_t)cap * sizeof(*size));
+    if (!size) return -1;
+    d->size = size;
+    time_t *mtime = realloc(d->mtime, (size_t)cap * sizeof(*mtime));
+    if (!mtime) return -1;
+    d->mtime = mtime;
+    int64_t *du = realloc(d->du, (size_t)cap * sizeof(*du));
+    if (!du) return -1;
+    d->du = du;
+    unsigned char *is_dir = realloc(d->is_dir, (size_t)cap);
+    if (!is_dir) return -1;
+    d->is_dir = is_dir;
+    unsigned char *is_hidden = realloc(d->is_hidden, (size_t)cap);
+    if (!is_hidden) return -1;
+    d->is_hidden = is_hidden;
+    unsigned char *meta = realloc(d->meta, (size_t)cap);
+    if (!meta) return -1;
+    d->meta = meta;
+    RowStyle *style = realloc(d->style, (size_t)cap * sizeof(*style));
+    if (!style) return -1;
+    d->style = style;
+    d->capacity = cap;
+    return 0;
+}
+
+// Collation key: compares like strcasecmp over the first 8 bytes, so most
+// name comparisons are a single integer compare.
+static uint64_t fold_key(const char *name, size_t len) {
+    uint64_t k = 0;
+    for (size_t j = 0; j < 8; j++) {
+        unsigned char c = j < len ? (unsigned char)tolower((unsigned char)name[j]) : 0;
+        k = (k << 8) | c;
+    }
+    return k;
+}
+
+static uint16_t ext_offset(const char *name, size_t len) {
+    const char *ext = strrchr(name, '.');
+    if (!ext || ext == name) return (uint16_t)len;
+    return (uint16_t)(ext - name + 1);
+}
+
+// Append a zeroed entry named `name`; returns its index or -1.
+static int listing_append(DirListing *d, const char *name, size_t len) {
+    if (listing_grow(d, d->count + 1) != 0) return -1;
+    if (d->names_len + len + 1 + SCAN_SLACK > d->names_cap) {
+        size_t cap = d->names_cap ? d->names_cap : NAMES_INITIAL_CAP;
+        while (cap < d->names_len + len + 1 + SCAN_SLACK) cap *= 2;
+        if (cap > UINT32_MAX) { errno = ENOMEM; return -1; }
+        char *names = realloc(d->names, cap);
+        if (!names) return -1;
+        d->names = names;
+        d->names_cap = cap;
+    }
+    int i = d->count++;
+    d->name_off[i] = (uint32_t)d->names_len;
+    memcpy(d->names + d->names_len, name, len);
+    d->names[d->names_len + len] = '\0';
+    d->names_len += len + 1;
+    d->fold[i] = fold_key(name, len);
+    d->ext_off[i] = ext_offset(d->names + d->name_off[i], len);
+    d->mode[i] = 0;
+    d->size[i] = 0;
+    d->mtime[i] = 0;
+    d->du[i] = 0;
+    d->is_dir[i] = 0;
+    d->is_hidden[i] = (name[0] == '.');
+    d->meta[i] = 0;
+    if (d->index_valid) {
+        if ((d->index_used + 1) * 2 > d->index_cap) index_rebuild(d, d->count);
+        else index_insert(d, (uint32_t)i);
+    }
+    return i;
+}
+
+static void listing_free(DirListing *d) {
+    free(d->names);
+    free(d->name_off);
+    free(d->fold);
+    free(d->ext_off);
+    free(d->mode);
+    free(d->size);
+    free(d->mtime);
+    free(d->du);
+    free(d->is_dir);
+    free(d->is_hidden);
+    free(d->meta);
+    free(d->style);
+    free(d->index);
+    memset(d, 0, sizeof(*d));
+}
+
+static inline const char *entry_name(const DirListing *d, uint32_t i) {
+    return d->names + d->name_off[i];
+}
+
+// Append a copy of src's entry i (name and columns); returns its index.
+static int listing_append_from(DirListing *d, const DirListing *src, int i) {
+    const char *name = entry_name(src, (uint32_t)i);
+    int j = listing_append(d, name, strlen(name));
+    if (j < 0) return -1;
+    d->mode[j] = src->mode[i];
+    d->size[j] = src->size[i];
+    d->mtime[j] = src->mtime[i];
+    d->du[j] = src->du[i];
+    d->is_dir[j] = src->is_dir[i];
+    d->meta[j] = src->meta[i];
+    d->style[j] = src->style[i];
+    return j;
+}
+
+// Entry called `name`, or -1. Entries flagged META_GONE only count
+// with `gone` set.
+static int listing_lookup(DirListing *d, const char *name, int gone) {
+    unsigned char skip = gone ? 0 : META_GONE;
+    if (!d->index_valid && index_rebuild(d, d->count) != 0) {
+        for (int i = 0; i < d->count; i++) {
+            if (!(d->meta[i] & skip) && strcmp(entry_name(d, i), name) == 0) return i;
+        }
+        return -1;
+    }
+    uint32_t mask = d->index_cap - 1;
+    for (uint32_t slot = name_hash(name) & mask; d->index[slot]; slot = (slot + 1) & mask) {
+        uint32_t i = d->index[slot] - 1;
+        if (!(d->meta[i] & skip) && strcmp(entry_name(d, i), name) == 0) return (int)i;
+    }
+    return -1;
+}
+
+// Live entry called `name`, or -1.
+static int listing_find(DirListing *d, const char *name) {
+    return listing_lookup(d, name, 0);
+}
+
+// Entry index shown at display row `row`.
+static inline uint32_t row_entry(const FileList *list, int row) {
+    return list->order[row];
+}
+
+static inline const char *row_name(const FileList *list, int row) {
+    return entry_name(&list->entries, row_entry(list, row));
+}
+
+static int entry_full_path(const FileList *list, uint32_t i, char *out, size_t out_len) {
+    int ret = snprintf(out, out_len, "%s/%s", list->cwd, entry_name(&list->entries, i));
+    if (ret < 0 || ret >= (int)out_len) { errno = ENAMETOOLONG; return -1; }
+    return 0;
+}
+
+static int list_reserve_order(FileList *list, int need) {
+    if (need <= list->order_cap) return 0;
+    int cap = list->order_cap ? list->order_cap : ENTRIES_INITIAL_CAP;
+    while (cap < need) {
+        if (cap > INT_MAX / 2) { errno = ENOMEM; return -1; }
+        cap *= 2;
+    }
+    uint32_t *order = realloc(list->order, (size_t)cap * sizeof(*order));
+    if (!order) return -1;
+    list->order = order;
+    list->order_cap = cap;
+    return 0;
+}
+
+static void loader_cancel(FileList *list);
+static void sort_cancel(FileList *list);
+static void prefetch_cancel(FileList *list);
+static void du_cancel(FileList *list);
+static void du_start(FileList *list);
+static void preview_drop(FileList *list);
+static uint64_t hash_bytes(const char *s, size_t len);
+
+// Rows as they were before a character was typed into the live filter,
+// so backspace puts them back without testing a single name.
+typedef struct FilterLevel {
+    uint32_t *rows;
+    int count;
+    int selected;
+} FilterLevel;
+
+// Forget the saved levels; called whenever the rows change any other way.
+static void filter_levels_drop(FileList *list) {
+    while (list->filter_depth > 0) free(list->filter_levels[--list->filter_depth].rows);
+}
+
+static void list_free(FileList *list) {
+    filter_levels_drop(list);
+    free(list->filter_levels);
+    list->filter_levels = NULL;
+    loader_cancel(list);
+    sort_cancel(list);
+    prefetch_cancel(list);
+    du_cancel(list);
+    preview_drop(list);
+    listing_free(&list->watch_pending);
+    if (list->watch_fd >= 0) close(list->watch_fd);
+    list->watch_fd = -1;
+    if (list->dir_fd >= 0) close(list->dir_fd);
+    list->dir_fd = -1;
+    listing_free(&list->entries);
+    free(list->order);
+    list->order = NULL;
+    list->order_cap = 0;
+    list->count = 0;
+    free(list->shown.row);
+    memset(&list->shown, 0, sizeof(list->shown));
+}
+
 static void popup_message(const char *title, const char *message) {
     int max_y, max_x;
     getmaxyx(stdscr, max_y, max_x);
@@ -263,26 +672,6 @@ static const char *pick_fuzzy_tool(void) {
     return NULL;
 }
 
-static int manual_select_in_list(FileList *list) {
-    char q[256] = {0};
-    if (!popup_prompt(q, sizeof(q), "Search", "Substring to match (empty cancels):")) return 0;
-    if (q[0] == '\0') return 0;
-    for (int i = 0; i < list->count; i++) {
-        if (strstr(list->items[i].name, q) != NULL) {
-            list->selected = i;
-            int max_y, max_x;
-            getmaxyx(stdscr, max_y, max_x);
-            int visible = max_y - 3;
-            if (list->selected < list->scroll_offset) list->scroll_offset = list->selected;
-            if (list->selected >= list->scroll_offset + visible)
-                list->scroll_offset = list->selected - visible + 1;
-            return 1;
-        }
-    }
-    popup_message("No match", "No items matched your query.");
-    return 0;
-}
-
 static int create_new_file(const char *cwd, const char *name) {
     if (!name || !*name || strchr(name, '/') || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
         errno = EINVAL; return -1;
@@ -306,393 +695,5428 @@ static int create_new_dir(const char *cwd, const char *name) {
     return mkdir(path, 0755);
 }
 
-static int delete_item_shallow(const FileItem *item) {
-    if (item->is_dir) {
-        if (rmdir(item->full_path) != 0) {
-            if (errno == EEXIST) errno = ENOTEMPTY;
-            return -1;
+static int delete_entry_shallow(const FileList *list, uint32_t i) {
+    char path[MAX_PATH];
+    if (entry_full_path(list, i, path, sizeof(path)) != 0) return -1;
+    if (list->entries.is_dir[i]) {
+        if (rmdir(path) != 0) {
+            if (errno == EEXIST) errno = ENOTEMPTY;
+            return -1;
+        }
+        return 0;
+    }
+    return unlink(path);
+}
+static int rename_entry(const FileList *list, uint32_t i, const char *new_name) {
+    if (!new_name || !*new_name || strchr(new_name, '/') ||
+        strcmp(new_name, ".") == 0 || strcmp(new_name, "..") == 0) {
+        errno = EINVAL; return -1;
+    }
+    char old_path[MAX_PATH];
+    if (entry_full_path(list, i, old_path, sizeof(old_path)) != 0) return -1;
+    char new_path[MAX_PATH];
+    int ret = snprintf(new_path, sizeof(new_path), "%s/%s", list->cwd, new_name);
+    if (ret < 0 || ret >= (int)sizeof(new_path)) { errno = ENAMETOOLONG; return -1; }
+    return rename(old_path, new_path);
+}
+
+// ---- row styles -------------------------------------------------------
+
+// Icons a row can show; RowStyle.icon indexes g_icons.
+enum {
+    ICON_ID_FILE, ICON_ID_FOLDER, ICON_ID_GIT, ICON_ID_HIDDEN, ICON_ID_EXEC,
+    ICON_ID_C, ICON_ID_PYTHON, ICON_ID_JS, ICON_ID_RUST, ICON_ID_GO,
+    ICON_ID_JSON, ICON_ID_MD, ICON_ID_YAML, ICON_ID_SH, ICON_ID_IMG
+};
+
+static const char *const g_icons[] = {
+    ICON_FILE, ICON_FOLDER, ICON_GIT, ICON_HIDDEN, ICON_EXEC,
+    ICON_C, ICON_PYTHON, ICON_JS, ICON_RUST, ICON_GO,
+    ICON_JSON, ICON_MD, ICON_YAML, ICON_SH, ICON_IMG
+};
+
+// Curses attributes a row can be drawn with; RowStyle.paint indexes
+// g_paint. The first nine are the built-in color pairs 0-8, LS_COLORS
+// appends its own.
+#define PAINT_MAX 256
+enum { PAINT_DIR = 1, PAINT_EXEC = 2, PAINT_PLAIN = 4, PAINT_BLUE = 5, PAINT_YELLOW = 6, PAINT_RED = 7 };
+
+static attr_t g_paint[PAINT_MAX];
+static int g_npaint;
+static int g_npairs = 9;      // color pairs in use; 1-8 are the built-in ones
+
+// Built-in extensions, in a table indexed by a perfect hash: the
+// extension's bytes (lowercased, at most 8, first byte lowest) times
+// EXT_HASH_MUL, top EXT_HASH_BITS bits. The multiplier was found by a
+// search over odd 64-bit values that keeps these extensions in distinct
+// slots; adding one means searching again. paint_init() asserts that each
+// entry sits in the slot its extension hashes to.
+#define EXT_HASH_MUL 0xd0fd57c9cf396ff1ULL
+#define EXT_HASH_BITS 5
+
+typedef struct {
+    char ext[8];
+    uint8_t icon;
+    uint8_t paint;
+} ExtStyle;
+
+static const ExtStyle g_ext_styles[1 << EXT_HASH_BITS] = {
+    [26] = { "c",    ICON_ID_C,      PAINT_BLUE },
+    [28] = { "h",    ICON_ID_C,      PAINT_BLUE },
+    [5]  = { "py",   ICON_ID_PYTHON, PAINT_YELLOW },
+    [10] = { "js",   ICON_ID_JS,     PAINT_EXEC },
+    [16] = { "ts",   ICON_ID_JS,     PAINT_EXEC },
+    [15] = { "jsx",  ICON_ID_JS,     PAINT_PLAIN },
+    [20] = { "tsx",  ICON_ID_JS,     PAINT_PLAIN },
+    [27] = { "rs",   ICON_ID_RUST,   PAINT_RED },
+    [29] = { "go",   ICON_ID_GO,     PAINT_PLAIN },
+    [3]  = { "json", ICON_ID_JSON,   PAINT_PLAIN },
+    [30] = { "md",   ICON_ID_MD,     PAINT_YELLOW },
+    [9]  = { "yaml", ICON_ID_YAML,   PAINT_PLAIN },
+    [21] = { "yml",  ICON_ID_YAML,   PAINT_PLAIN },
+    [25] = { "sh",   ICON_ID_SH,     PAINT_PLAIN },
+    [13] = { "bash", ICON_ID_SH,     PAINT_PLAIN },
+    [2]  = { "zsh",  ICON_ID_SH,     PAINT_PLAIN },
+    [19] = { "png",  ICON_ID_IMG,    PAINT_PLAIN },
+    [22] = { "jpg",  ICON_ID_IMG,    PAINT_PLAIN },
+    [6]  = { "jpeg", ICON_ID_IMG,    PAINT_PLAIN },
+    [31] = { "gif",  ICON_ID_IMG,    PAINT_PLAIN },
+};
+
+// File types LS_COLORS can paint, and the paint it gave each (0: none).
+enum { LS_DI, LS_LN, LS_EX, LS_FI, LS_SO, LS_PI, LS_BD, LS_CD, LS_TYPES };
+static uint8_t g_ls_type[LS_TYPES];
+
+// LS_COLORS "*.ext" entries: open addressing on the lowercased extension.
+#define LS_EXT_SLOTS 1024
+typedef struct {
+    char ext[16];
+    uint8_t paint;            // 0: empty slot
+} LsExt;
+static LsExt g_ls_ext[LS_EXT_SLOTS];
+static int g_ls_colors;       // LS_COLORS was parsed
+
+// Lowercase ext into out (zero padded to out_len); -1 if it does not fit.
+static int ext_fold(const char *ext, size_t len, char *out, size_t out_len) {
+    if (len == 0 || len > out_len) return -1;
+    memset(out, 0, out_len);
+    for (size_t i = 0; i < len; i++) out[i] = (char)tolower((unsigned char)ext[i]);
+    return 0;
+}
+
+static const ExtStyle *ext_style(const char *ext, size_t len) {
+    char key[8];
+    if (ext_fold(ext, len, key, sizeof(key)) != 0) return NULL;
+    uint64_t k = 0;
+    for (int i = 7; i >= 0; i--) k = k << 8 | (unsigned char)key[i];
+    const ExtStyle *es = &g_ext_styles[(k * EXT_HASH_MUL) >> (64 - EXT_HASH_BITS)];
+    return memcmp(es->ext, key, sizeof(key)) == 0 ? es : NULL;
+}
+
+static LsExt *ls_ext_slot(const char *key) {
+    uint32_t s = name_hash(key) & (LS_EXT_SLOTS - 1);
+    for (int n = 0; n < LS_EXT_SLOTS; n++, s = (s + 1) & (LS_EXT_SLOTS - 1)) {
+        if (!g_ls_ext[s].paint || strcmp(g_ls_ext[s].ext, key) == 0) return &g_ls_ext[s];
+    }
+    return NULL;
+}
+
+static int ls_ext_paint(const char *ext, size_t len) {
+    char key[16];
+    if (!g_ls_colors || ext_fold(ext, len, key, sizeof(key) - 1) != 0) return 0;
+    key[sizeof(key) - 1] = '\0';
+    LsExt *e = ls_ext_slot(key);
+    return e ? e->paint : 0;
+}
+
+// Paint for an SGR sequence like "01;38;5;208" (colors need start_color),
+// reusing an existing one when it comes out the same; 0 if none is left.
+static int paint_from_sgr(const char *s, size_t len) {
+    int code[32], n = 0;
+    for (size_t i = 0; i < len && n < 32; ) {
+        int v = 0;
+        while (i < len && isdigit((unsigned char)s[i])) v = v * 10 + (s[i++] - '0');
+        code[n++] = v;
+        while (i < len && !isdigit((unsigned char)s[i])) i++;
+    }
+    short fg = -1, bg = -1;
+    attr_t a = 0;
+    for (int i = 0; i < n; i++) {
+        int c = code[i];
+        if (c == 0) { fg = bg = -1; a = 0; }
+        else if (c == 1) a |= A_BOLD;
+        else if (c == 2) a |= A_DIM;
+        else if (c == 4) a |= A_UNDERLINE;
+        else if (c == 5) a |= A_BLINK;
+        else if (c == 7) a |= A_REVERSE;
+        else if (c >= 30 && c <= 37) fg = (short)(c - 30);
+        else if (c >= 40 && c <= 47) bg = (short)(c - 40);
+        else if (c >= 90 && c <= 97) fg = (short)(COLORS >= 16 ? c - 90 + 8 : c - 90);
+        else if (c >= 100 && c <= 107) bg = (short)(COLORS >= 16 ? c - 100 + 8 : c - 100);
+        else if (c == 39) fg = -1;
+        else if (c == 49) bg = -1;
+        else if ((c == 38 || c == 48) && i + 2 < n && code[i + 1] == 5) {
+            short v = (short)(code[i + 2] < COLORS ? code[i + 2] : -1);
+            if (c == 38) fg = v; else bg = v;
+            i += 2;
+        } else if ((c == 38 || c == 48) && i + 1 < n && code[i + 1] == 2) {
+            i += 4;     // 24-bit colors: not mapped
+        }
+    }
+    if (fg != -1 || bg != -1) {
+        int pair = 0;
+        for (int p = 9; p < g_npairs && !pair; p++) {
+            short pf, pb;
+            if (pair_content((short)p, &pf, &pb) == OK && pf == fg && pb == bg) pair = p;
+        }
+        if (!pair) {
+            if (g_npairs >= COLOR_PAIRS || init_pair((short)g_npairs, fg, bg) != OK) return 0;
+            pair = g_npairs++;
+        }
+        a |= COLOR_PAIR(pair);
+    }
+    for (int i = 1; i < g_npaint; i++)
+        if (g_paint[i] == a) return i;
+    if (g_npaint == PAINT_MAX) return 0;
+    g_paint[g_npaint] = a;
+    return g_npaint++;
+}
+
+// Built-in paints, then LS_COLORS (once, at startup).
+static void paint_init(void) {
+    for (int i = 0; i < (1 << EXT_HASH_BITS); i++) {
+        const ExtStyle *es = &g_ext_styles[i];
+        assert(!es->ext[0] || ext_style(es->ext, strnlen(es->ext, sizeof(es->ext))) == es);
+        (void)es;
+    }
+    for (int i = 0; i <= 8; i++) g_paint[i] = COLOR_PAIR(i);
+    g_npaint = 9;
+    const char *env = getenv("LS_COLORS");
+    if (!env || !*env || !has_colors()) return;
+    static const char *const types[LS_TYPES] = { "di", "ln", "ex", "fi", "so", "pi", "bd", "cd" };
+    for (const char *p = env; *p; ) {
+        const char *end = strchr(p, ':');
+        if (!end) end = p + strlen(p);
+        const char *eq = memchr(p, '=', (size_t)(end - p));
+        if (eq) {
+            size_t klen = (size_t)(eq - p);
+            int paint = paint_from_sgr(eq + 1, (size_t)(end - eq - 1));
+            if (klen > 2 && p[0] == '*' && p[1] == '.' && !memchr(p + 2, '.', klen - 2)) {
+                char key[16];
+                if (paint && ext_fold(p + 2, klen - 2, key, sizeof(key) - 1) == 0) {
+                    key[sizeof(key) - 1] = '\0';
+                    LsExt *e = ls_ext_slot(key);
+                    if (e) { memcpy(e->ext, key, sizeof(key)); e->paint = (uint8_t)paint; }
+                }
+            } else if (klen == 2) {
+                for (int t = 0; t < LS_TYPES; t++)
+                    if (memcmp(p, types[t], 2) == 0) g_ls_type[t] = (uint8_t)paint;
+            }
+        }
+        p = *end ? end + 1 : end;
+    }
+    g_ls_colors = 1;
+}
+
+// Size column text: at most 7 characters, one decimal past KiB, like
+// "%.1fK" but in integer arithmetic.
+void format_size(off_t size, char *buf, size_t len) {
+    static const char units[] = "KMGTPE";
+    if (size < 1024) {
+        snprintf(buf, len, "%lldB", (long long)size);
+        return;
+    }
+    int u = 0;
+    uint64_t unit = 1024;
+    while (u + 1 < (int)sizeof(units) - 1 && (uint64_t)size / unit >= 1024) { unit *= 1024; u++; }
+    uint64_t tenths = ((uint64_t)size / unit) * 10 + (((uint64_t)size % unit) * 10 + unit / 2) / unit;
+    snprintf(buf, len, "%llu.%llu%c", (unsigned long long)(tenths / 10), (unsigned long long)(tenths % 10), units[u]);
+}
+
+// Fill in entry i's style from its name and stat columns.
+static void style_entry(DirListing *d, uint32_t i) {
+    RowStyle *st = &d->style[i];
+    const char *name = entry_name(d, i);
+    mode_t mode = d->mode[i];
+    memset(st, 0, sizeof(*st));
+    if (d->is_dir[i]) {
+        st->icon = strcmp(name, ".git") == 0 ? ICON_ID_GIT : d->is_hidden[i] ? ICON_ID_HIDDEN : ICON_ID_FOLDER;
+        st->paint = g_ls_type[LS_DI] ? g_ls_type[LS_DI] : PAINT_DIR;
+        if (d->meta[i] & META_DU) format_size((off_t)d->du[i], st->size, sizeof(st->size));
+    } else {
+        // By the last dot, dotfiles included: unlike the ext sort key,
+        // ".bash" is a script and an executable ".bashrc" not a program.
+        const char *dot = strrchr(name, '.');
+        const char *ext = dot ? dot + 1 : "";
+        size_t elen = strlen(ext);
+        const ExtStyle *es = ext_style(ext, elen);
+        int exec = (mode & S_IXUSR) != 0;
+        st->icon = es ? es->icon : (!dot && exec) ? ICON_ID_EXEC : ICON_ID_FILE;
+        // like ls: a special type or an executable wins over the extension
+        int type = S_ISLNK(mode) ? LS_LN : S_ISSOCK(mode) ? LS_SO : S_ISFIFO(mode) ? LS_PI :
+                   S_ISBLK(mode) ? LS_BD : S_ISCHR(mode) ? LS_CD : exec ? LS_EX : LS_FI;
+        int paint = type != LS_FI ? g_ls_type[type] : 0;
+        if (!paint && exec) paint = PAINT_EXEC;
+        if (!paint) paint = ls_ext_paint(ext, elen);
+        if (!paint && !g_ls_colors && es) paint = es->paint;
+        if (!paint) paint = g_ls_type[LS_FI] ? g_ls_type[LS_FI] : PAINT_PLAIN;
+        st->paint = (uint8_t)paint;
+        format_size(d->size[i], st->size, sizeof(st->size));
+    }
+    d->meta[i] |= META_STYLE;
+}
+
+static const RowStyle *row_style(DirListing *d, uint32_t i) {
+    if (!(d->meta[i] & META_STYLE)) style_entry(d, i);
+    return &d->style[i];
+}
+
+// Sort order without sort_reverse applied: directories first, then the
+// sort key, then the name. Names compare on the precomputed fold key and
+// only fall back to strcasecmp when the first 8 bytes tie.
+static int compare_names(const DirListing *d, uint32_t A, uint32_t B) {
+    if (d->fold[A] != d->fold[B]) return d->fold[A] < d->fold[B] ? -1 : 1;
+    return strcasecmp(entry_name(d, A), entry_name(d, B));
+}
+
+// SORT_DU key: a directory's total once the walker has reported it, a
+// file's size.
+static int64_t du_key(const DirListing *d, uint32_t e) {
+    if (!d->is_dir[e]) return (int64_t)d->size[e];
+    return (d->meta[e] & META_DU) ? d->du[e] : 0;
+}
+
+static int compare_forward(const FileList *list, uint32_t A, uint32_t B) {
+    const DirListing *d = &list->entries;
+    if (d->is_dir[A] != d->is_dir[B]) return d->is_dir[B] - d->is_dir[A];
+    switch (list->sort_mode) {
+        case SORT_SIZE:
+            if (d->size[A] != d->size[B]) return d->size[A] < d->size[B] ? -1 : 1;
+            break;
+        case SORT_TIME:
+            if (d->mtime[A] != d->mtime[B]) return d->mtime[A] < d->mtime[B] ? -1 : 1;
+            break;
+        case SORT_DU: {
+            int64_t a = du_key(d, A), b = du_key(d, B);
+            if (a != b) return a < b ? -1 : 1;
+            break;
+        }
+        case SORT_EXT: {
+            int r = strcasecmp(entry_name(d, A) + d->ext_off[A], entry_name(d, B) + d->ext_off[B]);
+            if (r) return r;
+            break;
+        }
+        default: break;
+    }
+    return compare_names(d, A, B);
+}
+
+// Order of entries A and B in the listing as displayed.
+static int compare_items(const FileList *list, uint32_t A, uint32_t B) {
+    int r = compare_forward(list, A, B);
+    return list->sort_reverse ? -r : r;
+}
+
+// What the sort actually moves: the entry index plus its keys, copied
+// into one contiguous array so comparisons rarely touch the columns.
+typedef struct {
+    uint64_t key;     // fold key of the name or extension, or the numeric key
+    uint64_t fold;    // tie-break: next 8 bytes of that name or extension, or
+                      // the name's fold key after a numeric key
+    uint32_t e;
+    uint32_t group;   // 0 for directories, 1 for files
+} SortKey;
+
+// Like compare_forward, but the tail only reads names, never the stat
+// columns, so a background sort can run while rows are being stat'ed.
+static int compare_keys(const FileList *list, const SortKey *a, const SortKey *b) {
+    if (a->group != b->group) return a->group < b->group ? -1 : 1;
+    if (a->key != b->key) return a->key < b->key ? -1 : 1;
+    if (a->fold != b->fold) return a->fold < b->fold ? -1 : 1;
+    const DirListing *d = &list->entries;
+    if (list->sort_mode == SORT_EXT) {
+        int r = strcasecmp(entry_name(d, a->e) + d->ext_off[a->e], entry_name(d, b->e) + d->ext_off[b->e]);
+        if (r) return r;
+        return compare_names(d, a->e, b->e);
+    }
+    return strcasecmp(entry_name(d, a->e), entry_name(d, b->e));
+}
+
+// Stable merge sort of k[lo, hi) using tmp as scratch.
+static void merge_sort_keys(const FileList *list, SortKey *k, SortKey *tmp, int lo, int hi) {
+    if (hi - lo <= 16) {
+        for (int i = lo + 1; i < hi; i++) {
+            SortKey v = k[i];
+            int j = i;
+            while (j > lo && compare_keys(list, &k[j - 1], &v) > 0) {
+                k[j] = k[j - 1];
+                j--;
+            }
+            k[j] = v;
+        }
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    merge_sort_keys(list, k, tmp, lo, mid);
+    merge_sort_keys(list, k, tmp, mid, hi);
+    if (compare_keys(list, &k[mid - 1], &k[mid]) <= 0) return;
+    memcpy(tmp + lo, k + lo, (size_t)(hi - lo) * sizeof(*k));
+    int a = lo, b = mid, o = lo;
+    while (a < mid && b < hi) k[o++] = compare_keys(list, &tmp[b], &tmp[a]) < 0 ? tmp[b++] : tmp[a++];
+    while (a < mid) k[o++] = tmp[a++];
+    while (b < hi) k[o++] = tmp[b++];
+}
+
+// Stable LSD radix sort by group and key, 8 bits per pass. Passes where
+// every key shares the same byte are skipped.
+static void radix_sort_keys(SortKey *k, SortKey *tmp, int n) {
+    for (int shift = 0; shift <= 64; shift += 8) {
+        int count[257] = {0};
+        for (int i = 0; i < n; i++) {
+            unsigned byte = shift < 64 ? (unsigned)(k[i].key >> shift) & 0xff : k[i].group;
+            count[byte + 1]++;
+        }
+        unsigned first = shift < 64 ? (unsigned)(k[0].key >> shift) & 0xff : k[0].group;
+        if (count[first + 1] == n) continue;
+        for (int b = 0; b < 256; b++) count[b + 1] += count[b];
+        for (int i = 0; i < n; i++) {
+            unsigned byte = shift < 64 ? (unsigned)(k[i].key >> shift) & 0xff : k[i].group;
+            tmp[count[byte]++] = k[i];
+        }
+        memcpy(k, tmp, (size_t)n * sizeof(*k));
+    }
+}
+
+static void reverse_rows(uint32_t *rows, int n) {
+    for (int a = 0, b = n - 1; a < b; a++, b--) {
+        uint32_t t = rows[a];
+        rows[a] = rows[b];
+        rows[b] = t;
+    }
+}
+
+static uint64_t fold_tail(const char *s) {
+    size_t len = strlen(s);
+    return len > 8 ? fold_key(s + 8, len - 8) : 0;
+}
+
+static void fill_sort_keys(const FileList *list, const uint32_t *rows, SortKey *k, int n) {
+    const DirListing *d = &list->entries;
+    for (int i = 0; i < n; i++) {
+        uint32_t e = rows[i];
+        k[i].e = e;
+        k[i].group = d->is_dir[e] ? 0 : 1;
+        k[i].fold = d->fold[e];
+        if (list->sort_mode == SORT_SIZE) {
+            // Flip the sign bit so signed values order as unsigned ones.
+            k[i].key = (uint64_t)(int64_t)d->size[e] ^ (1ULL << 63);
+        } else if (list->sort_mode == SORT_TIME) {
+            k[i].key = (uint64_t)(int64_t)d->mtime[e] ^ (1ULL << 63);
+        } else if (list->sort_mode == SORT_DU) {
+            k[i].key = (uint64_t)du_key(d, e) ^ (1ULL << 63);
+        } else if (list->sort_mode == SORT_EXT) {
+            const char *ext = entry_name(d, e) + d->ext_off[e];
+            k[i].key = fold_key(ext, strlen(ext));
+            k[i].fold = fold_tail(ext);
+        } else {
+            k[i].key = d->fold[e];
+            k[i].fold = fold_tail(entry_name(d, e));
+        }
+    }
+}
+
+// Sort n keys into forward order. Name and extension views merge sort;
+// size and time views radix sort the numeric key, then name-sort each
+// run of equal keys.
+static void sort_keys(const FileList *list, SortKey *k, SortKey *tmp, int n) {
+    if (list->sort_mode == SORT_SIZE || list->sort_mode == SORT_TIME || list->sort_mode == SORT_DU) {
+        radix_sort_keys(k, tmp, n);
+        for (int lo = 0, hi; lo < n; lo = hi) {
+            for (hi = lo + 1; hi < n && k[hi].key == k[lo].key && k[hi].group == k[lo].group; hi++) {}
+            if (hi - lo > 1) merge_sort_keys(list, k, tmp, lo, hi);
+        }
+    } else {
+        merge_sort_keys(list, k, tmp, 0, n);
+    }
+}
+
+// Sort rows (entry indices) for display. Reversed views reverse the
+// finished order.
+static void sort_rows(FileList *list, uint32_t *rows, int n) {
+    if (n < 2) return;
+    SortKey *k = malloc((size_t)n * 2 * sizeof(*k));
+    if (!k) return;
+    fill_sort_keys(list, rows, k, n);
+    sort_keys(list, k, k + n, n);
+    for (int i = 0; i < n; i++) rows[i] = k[i].e;
+    free(k);
+    if (list->sort_reverse) reverse_rows(rows, n);
+}
+
+static int equal_ci(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return 0;
+    }
+    return 1;
+}
+
+// Offset of the first occurrence of needle in s (len bytes, with
+// SCAN_SLACK readable bytes after it), ignoring ASCII case, or -1. The
+// vector loop tests 16 start positions at once against the needle's
+// first and last byte and only compares the middle where both agree,
+// which is rare.
+static ptrdiff_t find_substr_ci(const char *s, size_t len, const char *needle, size_t nlen) {
+    if (nlen == 0) return 0;
+    if (nlen > len) return -1;
+    size_t mid = nlen > 2 ? nlen - 2 : 0;
+#if defined(__SSE2__)
+    unsigned char f = (unsigned char)tolower((unsigned char)needle[0]);
+    unsigned char l = (unsigned char)tolower((unsigned char)needle[nlen - 1]);
+    const __m128i f_lo = _mm_set1_epi8((char)f), f_up = _mm_set1_epi8((char)toupper(f));
+    const __m128i l_lo = _mm_set1_epi8((char)l), l_up = _mm_set1_epi8((char)toupper(l));
+    size_t last = len - nlen;   // last start position
+    for (size_t i = 0; i <= last; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + nlen - 1));
+        __m128i hit = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(a, f_lo), _mm_cmpeq_epi8(a, f_up)),
+                                    _mm_or_si128(_mm_cmpeq_epi8(b, l_lo), _mm_cmpeq_epi8(b, l_up)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (last - i < 15) mask &= (2u << (last - i)) - 1;
+        for (; mask; mask &= mask - 1) {
+            size_t at = i + (size_t)__builtin_ctz(mask);
+            if (equal_ci(s + at + 1, needle + 1, mid)) return (ptrdiff_t)at;
+        }
+    }
+    return -1;
+#else
+    for (size_t at = 0; at + nlen <= len; at++) {
+        if (equal_ci(s + at, needle, 1) && equal_ci(s + at + nlen - 1, needle + nlen - 1, 1) &&
+            equal_ci(s + at + 1, needle + 1, mid)) return (ptrdiff_t)at;
+    }
+    return -1;
+#endif
+}
+
+static int contains_ci(const char *s, size_t len, const char *needle, size_t nlen) {
+    return find_substr_ci(s, len, needle, nlen) >= 0;
+}
+
+// `name` must sit in a listing's names arena (see contains_ci).
+static int passes_filter(const FileList *list, const char *name, int is_dir) {
+    switch (list->filter_mode) {
+        case FILTER_ALL:      return 1;
+        case FILTER_FILES:    return !is_dir;
+        case FILTER_DIRS:     return is_dir;
+        case FILTER_CONTAINS:
+            if (list->filter_text[0] == '\0') return 1;
+            return contains_ci(name, strlen(name), list->filter_text, strlen(list->filter_text));
+        default: return 1;
+    }
+}
+
+// Whether loaded entry i is shown under the current hidden/filter settings.
+static int entry_visible(const FileList *list, uint32_t i) {
+    const DirListing *d = &list->entries;
+    if (d->meta[i] & META_GONE) return 0;
+    if (d->is_hidden[i] && !list->show_hidden) return 0;
+    return passes_filter(list, entry_name(d, i), d->is_dir[i]);
+}
+
+
+// Metadata columns a load must fetch for the current view. Directories
+// never show a size, so name/ext views classify them from d_type alone;
+// in lazy mode files are left for draw_ui to stat as they scroll in.
+static unsigned view_meta_need(const FileList *list, int is_dir) {
+    unsigned need = META_TYPE;
+    switch (list->sort_mode) {
+        case SORT_SIZE:
+        case SORT_DU:   need |= META_SIZE; break;
+        case SORT_TIME: need |= META_SIZE | META_MTIME; break;
+        default: break;
+    }
+    if (!is_dir && !list->lazy_meta) need |= META_SIZE;
+    return need;
+}
+
+// Metadata needed to draw one row (icon, color and size column).
+static unsigned row_meta_need(int is_dir) {
+    return is_dir ? META_TYPE : (META_TYPE | META_SIZE);
+}
+
+// Fill the requested columns of entry i with one stat relative to dir_fd,
+// so the kernel never re-walks cwd. Failures leave zeros, like lstat did.
+// Once an entry needs more than its type, size and mtime come along too:
+// they cost nothing extra and a later sort switch then needs no stat.
+static int stat_entry_at(DirListing *d, int dir_fd, int i, unsigned need) {
+    const char *name = entry_name(d, i);
+    int rc;
+    if (need & (META_SIZE | META_MTIME)) need |= META_SIZE | META_MTIME;
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+    unsigned mask = STATX_TYPE;
+    if (need & META_SIZE) mask |= STATX_MODE | STATX_SIZE;
+    if (need & META_MTIME) mask |= STATX_MTIME;
+    struct statx stx;
+    rc = statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx);
+    if (rc == 0) {
+        d->mode[i] = stx.stx_mode;
+        d->is_dir[i] = S_ISDIR(stx.stx_mode);
+        if (stx.stx_mask & STATX_SIZE) d->size[i] = (off_t)stx.stx_size;
+        if (stx.stx_mask & STATX_MTIME) d->mtime[i] = (time_t)stx.stx_mtime.tv_sec;
+    }
+#else
+    struct stat st;
+    rc = fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW);
+    if (rc == 0) {
+        d->mode[i] = st.st_mode;
+        d->size[i] = st.st_size;
+        d->mtime[i] = st.st_mtime;
+        d->is_dir[i] = S_ISDIR(st.st_mode);
+    }
+#endif
+    d->meta[i] = (unsigned char)((d->meta[i] | need | META_TYPE) & ~META_STYLE);
+    return rc;
+}
+
+// Add one directory entry to d. Hidden and filtered-out entries are kept
+// too: the view over them is rebuilt in memory when those settings change.
+// d_type is used when it already answers whether the entry is a directory.
+static void add_dirent(DirListing *d, const char *name, unsigned char type) {
+    int i = listing_append(d, name, strlen(name));
+    if (i < 0) return;
+    if (type != DT_UNKNOWN) {
+        d->is_dir[i] = (unsigned char)(type == DT_DIR);
+        d->meta[i] = META_TYPE;
+    }
+}
+
+// Reads a directory fd in chunks so a load can stop part way and carry on
+// later (or on another thread). The fd itself belongs to the caller.
+typedef struct {
+    int fd;
+#ifdef __linux__
+    char *buf;
+#else
+    DIR *dir;
+#endif
+} DirReader;
+
+#ifdef __linux__
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static int dir_reader_open(DirReader *r, int fd) {
+    r->fd = fd;
+    r->buf = malloc(GETDENTS_BUF_SIZE);
+    return r->buf ? 0 : -1;
+}
+
+static void dir_reader_close(DirReader *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+// Append up to max_bytes worth of entries (one getdents64 call) to d.
+// Returns 1 if more may follow, 0 at end of directory, -1 on error.
+static int dir_reader_next(DirReader *r, DirListing *d, size_t max_bytes) {
+    if (max_bytes > GETDENTS_BUF_SIZE) max_bytes = GETDENTS_BUF_SIZE;
+    long n;
+    do {
+        n = syscall(SYS_getdents64, r->fd, r->buf, max_bytes);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    if (n == 0) return 0;
+    for (long off = 0; off < n; ) {
+        struct linux_dirent64 *de = (struct linux_dirent64 *)(r->buf + off);
+        add_dirent(d, de->d_name, de->d_type);
+        off += de->d_reclen;
+    }
+    return 1;
+}
+#else
+static int dir_reader_open(DirReader *r, int fd) {
+    r->fd = fd;
+    int dup_fd = dup(fd);
+    if (dup_fd < 0) return -1;
+    r->dir = fdopendir(dup_fd);
+    if (!r->dir) { close(dup_fd); return -1; }
+    rewinddir(r->dir);
+    return 0;
+}
+
+static void dir_reader_close(DirReader *r) {
+    if (r->dir) closedir(r->dir);
+    r->dir = NULL;
+}
+
+static int dir_reader_next(DirReader *r, DirListing *d, size_t max_bytes) {
+    size_t budget = max_bytes / 32;   // rough dirent size, matches getdents batching
+    for (size_t k = 0; k < budget; k++) {
+        errno = 0;
+        struct dirent *entry = readdir(r->dir);
+        if (!entry) return errno ? -1 : 0;
+#ifdef DT_UNKNOWN
+        add_dirent(d, entry->d_name, entry->d_type);
+#else
+        add_dirent(d, entry->d_name, 0);
+#endif
+    }
+    return 1;
+}
+#endif
+
+// ---- parallel stat ----------------------------------------------------
+
+typedef void (*range_fn)(void *ctx, int begin, int end);
+
+typedef struct {
+    range_fn fn;
+    void *ctx;
+    int n;
+    int chunk;
+    atomic_int next;
+} ParallelFor;
+
+static void *parallel_for_worker(void *arg) {
+    ParallelFor *pf = arg;
+    for (;;) {
+        int begin = atomic_fetch_add(&pf->next, pf->chunk);
+        if (begin >= pf->n) break;
+        int end = begin + pf->chunk;
+        if (end > pf->n) end = pf->n;
+        pf->fn(pf->ctx, begin, end);
+    }
+    return NULL;
+}
+
+// Run fn over [0, n) in chunks on up to `workers` threads, the caller
+// being one of them. Returns once every chunk is done.
+static void parallel_for(int n, int chunk, int workers, range_fn fn, void *ctx) {
+    ParallelFor pf = { .fn = fn, .ctx = ctx, .n = n, .chunk = chunk > 0 ? chunk : 1 };
+    atomic_init(&pf.next, 0);
+    if (workers > STAT_WORKERS_MAX) workers = STAT_WORKERS_MAX;
+    pthread_t tids[STAT_WORKERS_MAX];
+    int started = 0;
+    for (int i = 1; i < workers; i++) {
+        if (pthread_create(&tids[started], NULL, parallel_for_worker, &pf) != 0) break;
+        started++;
+    }
+    parallel_for_worker(&pf);
+    for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+}
+
+// Stat workers to use; GOTO_STAT_WORKERS overrides (1 disables threading).
+// Stats are latency bound on NFS/FUSE, so default to at least 4.
+static int stat_worker_count(void) {
+    static int workers = 0;
+    if (workers > 0) return workers;
+    const char *env = getenv("GOTO_STAT_WORKERS");
+    long n = 0;
+    if (env && *env) n = strtol(env, NULL, 10);
+    if (n <= 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n < 4) n = 4;
+        if (n > 16) n = 16;
+    }
+    if (n > STAT_WORKERS_MAX) n = STAT_WORKERS_MAX;
+    workers = (int)n;
+    return workers;
+}
+
+typedef struct {
+    const FileList *list;
+    DirListing *d;
+    int dir_fd;
+    int first;              // entries before this one are already done
+    const uint32_t *todo;   // explicit entries to stat with todo_need, or NULL
+    unsigned todo_need;
+    atomic_int *cancel;     // optional; checked between stats
+} StatPass;
+
+static void stat_range(void *ctx, int begin, int end) {
+    StatPass *sp = ctx;
+    for (int k = begin; k < end; k++) {
+        if (sp->cancel && atomic_load_explicit(sp->cancel, memory_order_relaxed)) return;
+        if (sp->todo) {
+            stat_entry_at(sp->d, sp->dir_fd, (int)sp->todo[k], sp->todo_need);
+            continue;
+        }
+        int i = sp->first + k;
+        unsigned need = view_meta_need(sp->list, sp->d->is_dir[i]);
+        if ((sp->d->meta[i] & need) != need) stat_entry_at(sp->d, sp->dir_fd, i, need);
+    }
+}
+
+// Fetch whatever metadata `view` still lacks for entries [first, count)
+// of d. Each worker writes only its own entries, so no locking is needed.
+static void stat_entries(const FileList *view, DirListing *d, int dir_fd, int first, atomic_int *cancel) {
+    StatPass sp = { .list = view, .d = d, .dir_fd = dir_fd, .first = first, .cancel = cancel };
+    int n = d->count - first;
+    if (n <= 0) return;
+    int workers = stat_worker_count();
+    if (n < STAT_PARALLEL_MIN || workers <= 1) {
+        stat_range(&sp, 0, n);
+        return;
+    }
+    parallel_for(n, STAT_CHUNK, workers, stat_range, &sp);
+}
+
+// Lazy mode: stat the rows about to be drawn plus a prefetch margin on
+// both sides, so scrolling a page rarely waits on metadata.
+static void stat_visible_rows(FileList *list, int first, int rows) {
+    if (!list->lazy_meta || list->dir_fd < 0) return;
+    DirListing *d = &list->entries;
+    int lo = first - LAZY_PREFETCH_ROWS;
+    int hi = first + rows + LAZY_PREFETCH_ROWS;
+    if (lo < 0) lo = 0;
+    if (hi > list->count) hi = list->count;
+    if (hi <= lo) return;
+    uint32_t *todo = malloc((size_t)(hi - lo) * sizeof(*todo));
+    if (!todo) return;
+    int n = 0;
+    for (int r = lo; r < hi; r++) {
+        uint32_t e = row_entry(list, r);
+        unsigned need = row_meta_need(d->is_dir[e]);
+        if ((d->meta[e] & need) != need) todo[n++] = e;
+    }
+    StatPass sp = { .list = list, .d = d, .dir_fd = list->dir_fd,
+                    .todo = todo, .todo_need = META_TYPE | META_SIZE };
+    int workers = stat_worker_count();
+    if (n < LAZY_PARALLEL_MIN || workers <= 1) stat_range(&sp, 0, n);
+    else parallel_for(n, 8, workers, stat_range, &sp);
+    free(todo);
+}
+
+// ---- background loading -----------------------------------------------
+
+typedef struct LoadBatch {
+    struct LoadBatch *next;
+    DirListing entries;
+} LoadBatch;
+
+// Finishes reading a large directory off the UI thread. Batches are handed
+// over through a locked queue; loader_pump() merges them on the UI thread.
+typedef struct DirLoader {
+    pthread_t thread;
+    DirReader reader;
+    FileList view;            // settings snapshot; its containers are unused
+    atomic_int cancel;
+    pthread_mutex_t lock;
+    LoadBatch *head, *tail;   // guarded by lock
+    int done;                 // guarded by lock
+} DirLoader;
+
+static double elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) * 1000.0 +
+           (double)(now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+static void free_batches(LoadBatch *b) {
+    while (b) {
+        LoadBatch *next = b->next;
+        listing_free(&b->entries);
+        free(b);
+        b = next;
+    }
+}
+
+static void *dir_loader_main(void *arg) {
+    DirLoader *job = arg;
+    int more = 1;
+    while (more > 0 && !atomic_load(&job->cancel)) {
+        LoadBatch *b = calloc(1, sizeof(*b));
+        if (!b) break;
+        more = dir_reader_next(&job->reader, &b->entries, GETDENTS_BUF_SIZE);
+        stat_entries(&job->view, &b->entries, job->reader.fd, 0, &job->cancel);
+        if (b->entries.count == 0) { free_batches(b); continue; }
+        pthread_mutex_lock(&job->lock);
+        if (job->tail) job->tail->next = b;
+        else job->head = b;
+        job->tail = b;
+        pthread_mutex_unlock(&job->lock);
+    }
+    pthread_mutex_lock(&job->lock);
+    job->done = 1;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static int loader_start(FileList *list, DirReader *reader) {
+    DirLoader *job = calloc(1, sizeof(*job));
+    if (!job) return -1;
+    job->reader = *reader;
+    job->view = *list;
+    job->view.entries = (DirListing){0};
+    job->view.order = NULL;
+    job->view.order_cap = 0;
+    job->view.loader = NULL;
+    atomic_init(&job->cancel, 0);
+    pthread_mutex_init(&job->lock, NULL);
+    if (pthread_create(&job->thread, NULL, dir_loader_main, job) != 0) {
+        pthread_mutex_destroy(&job->lock);
+        free(job);
+        return -1;
+    }
+    list->loader = job;
+    return 0;
+}
+
+static void loader_destroy(DirLoader *job) {
+    pthread_join(job->thread, NULL);
+    free_batches(job->head);
+    dir_reader_close(&job->reader);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+// Stop an in-flight load. Stats check the flag between entries, so this
+// waits for at most one syscall per worker.
+static void loader_cancel(FileList *list) {
+    if (!list->loader) return;
+    atomic_store(&list->loader->cancel, 1);
+    loader_destroy(list->loader);
+    list->loader = NULL;
+    list->pending_select[0] = '\0';
+}
+
+static void scroll_to_selected(FileList *list, int visible) {
+    if (visible < 1) visible = 1;
+    if (list->selected < list->scroll_offset) list->scroll_offset = list->selected;
+    if (list->selected >= list->scroll_offset + visible)
+        list->scroll_offset = list->selected - visible + 1;
+    // Never leave blank rows below the last entry.
+    if (list->scroll_offset > list->count - visible) list->scroll_offset = list->count - visible;
+    if (list->scroll_offset < 0) list->scroll_offset = 0;
+}
+
+// Sort fresh[0..nf) and merge it into the already sorted order. The
+// cursor stays on the entry it was on.
+static void merge_rows(FileList *list, uint32_t *fresh, int nf) {
+    if (nf <= 0) return;
+    filter_levels_drop(list);
+    sort_rows(list, fresh, nf);
+    int total = list->count + nf;
+    uint32_t *merged = malloc((size_t)total * sizeof(*merged));
+    if (!merged) return;
+    // A cursor still parked on the first row stays there; otherwise it
+    // follows its entry as new rows land above it.
+    int pin_top = (list->selected == 0 && list->scroll_offset == 0);
+    int has_sel = !pin_top && list->selected >= 0 && list->selected < list->count;
+    uint32_t sel = has_sel ? row_entry(list, list->selected) : 0;
+    int new_sel = 0;
+    int a = 0, b = 0, k = 0;
+    while (a < list->count || b < nf) {
+        if (b >= nf || (a < list->count && compare_items(list, list->order[a], fresh[b]) <= 0)) {
+            if (has_sel && list->order[a] == sel) new_sel = k;
+            merged[k++] = list->order[a++];
+        } else {
+            merged[k++] = fresh[b++];
+        }
+    }
+    free(list->order);
+    list->order = merged;
+    list->order_cap = total;
+    list->count = total;
+    list->scroll_offset += new_sel - list->selected;
+    list->selected = new_sel;
+    if (list->scroll_offset < 0) list->scroll_offset = 0;
+    if (list->pending_select[0]) {
+        for (int r = 0; r < list->count; r++) {
+            if (strcmp(row_name(list, r), list->pending_select) == 0) {
+                list->selected = r;
+                list->pending_select[0] = '\0';
+                break;
+            }
+        }
+    }
+    int max_y = getmaxy(stdscr);
+    scroll_to_selected(list, max_y - 3);
+}
+
+// Move entries fresh[0..nf), flagged META_DIRTY, to the rows their
+// (changed) columns now sort to; gone and filtered-out ones are dropped.
+// Reorders fresh in place.
+static void reposition_entries(FileList *list, uint32_t *fresh, int nf) {
+    DirListing *d = &list->entries;
+    filter_levels_drop(list);
+    // Drop every patched row; the cursor falls to the next surviving row.
+    int has_sel = list->selected >= 0 && list->selected < list->count;
+    uint32_t sel_entry = has_sel ? row_entry(list, list->selected) : 0;
+    int new_sel = 0, w = 0;
+    for (int r = 0; r < list->count; r++) {
+        uint32_t e = list->order[r];
+        if (r == list->selected) new_sel = w;
+        if (d->meta[e] & META_DIRTY) continue;
+        list->order[w++] = e;
+    }
+    list->count = w;
+    list->selected = new_sel < w ? new_sel : (w > 0 ? w - 1 : 0);
+    // Re-insert what still exists and passes the filter.
+    int nk = 0;
+    for (int k = 0; k < nf; k++) {
+        uint32_t e = fresh[k];
+        d->meta[e] &= (unsigned char)~META_DIRTY;
+        if (entry_visible(list, e)) fresh[nk++] = e;
+    }
+    if (list_reserve_order(list, list->count + nk) == 0) merge_rows(list, fresh, nk);
+    if (has_sel && !(d->meta[sel_entry] & META_GONE)) {
+        for (int r = 0; r < list->count; r++) {
+            if (list->order[r] == sel_entry) { list->selected = r; break; }
+        }
+    }
+    scroll_to_selected(list, getmaxy(stdscr) - 3);
+}
+
+// Merge the visible entries in [first_new, count) into the order.
+static void merge_new_rows(FileList *list, int first_new) {
+    DirListing *d = &list->entries;
+    int added = d->count - first_new;
+    if (added <= 0) return;
+    uint32_t *fresh = malloc((size_t)added * sizeof(*fresh));
+    if (!fresh) return;
+    int nf = 0;
+    for (int i = first_new; i < d->count; i++) {
+        if (entry_visible(list, (uint32_t)i)) fresh[nf++] = (uint32_t)i;
+    }
+    merge_rows(list, fresh, nf);
+    free(fresh);
+}
+
+// Move whatever the background loader has produced into the listing.
+static void loader_pump(FileList *list) {
+    DirLoader *job = list->loader;
+    // Batches wait in the queue while a background sort owns the order.
+    if (!job || list->sorter) return;
+    pthread_mutex_lock(&job->lock);
+    LoadBatch *batches = job->head;
+    job->head = job->tail = NULL;
+    int done = job->done;
+    pthread_mutex_unlock(&job->lock);
+    int first_new = list->entries.count;
+    for (LoadBatch *b = batches; b; b = b->next) {
+        for (int i = 0; i < b->entries.count; i++) {
+            // Entries already patched in by a file operation stay unique,
+            // and ones it deleted stay deleted: the batch may have read the
+            // name before it went.
+            if (list->entries.index_valid &&
+                listing_lookup(&list->entries, entry_name(&b->entries, (uint32_t)i), 1) >= 0) continue;
+            listing_append_from(&list->entries, &b->entries, i);
+        }
+    }
+    free_batches(batches);
+    // The loader stats for the view it started with; catch up if the sort
+    // has changed since.
+    stat_entries(list, &list->entries, list->dir_fd, first_new, NULL);
+    merge_new_rows(list, first_new);
+    if (done) {
+        loader_destroy(job);
+        list->loader = NULL;
+        list->pending_select[0] = '\0';
+        if (list->sort_mode == SORT_DU) du_start(list);
+    }
+}
+
+// Put the cursor on `name`, now or as soon as the loader delivers it.
+// Returns 1 if the entry was found right away.
+static int select_entry_by_name(FileList *list, const char *name) {
+    for (int r = 0; r < list->count; r++) {
+        if (strcmp(row_name(list, r), name) == 0) {
+            list->selected = r;
+            scroll_to_selected(list, getmaxy(stdscr) - 3);
+            return 1;
+        }
+    }
+    if (list->loader) {
+        strncpy(list->pending_select, name, sizeof(list->pending_select) - 1);
+        list->pending_select[sizeof(list->pending_select) - 1] = '\0';
+    }
+    return 0;
+}
+
+// ---- background sort --------------------------------------------------
+
+// Very large listings are sorted in two steps: the rows near either end of
+// the order are selected and sorted right away, so the first frame (and G,
+// and a reversed view) are exact, then a parallel merge sort finishes the
+// whole order off the UI thread and sort_pump() installs it. The job only
+// reads names and its own key array; while it runs, nothing appends to
+// the listing or reorders the rows.
+typedef struct SortJob {
+    pthread_t thread;
+    FileList view;            // settings and entry columns; nothing is owned
+    SortKey *keys, *tmp;
+    SortKey *sorted;          // keys or tmp, whichever ends up holding the result
+    int n;
+    int pieces;
+    int bounds[SORT_PIECES_MAX + 1];
+    atomic_int cancel;
+    atomic_int done;
+} SortJob;
+
+typedef struct {
+    SortJob *job;
+    const SortKey *src;
+    SortKey *dst;
+    int runs;
+} SortMergeLevel;
+
+static int sort_worker_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > SORT_PIECES_MAX) n = SORT_PIECES_MAX;
+    return (int)n;
+}
+
+static void sort_pieces(void *ctx, int begin, int end) {
+    SortJob *job = ctx;
+    for (int p = begin; p < end; p++) {
+        if (atomic_load_explicit(&job->cancel, memory_order_relaxed)) return;
+        int lo = job->bounds[p], hi = job->bounds[p + 1];
+        sort_keys(&job->view, job->keys + lo, job->tmp + lo, hi - lo);
+    }
+}
+
+// Merge sorted runs 2p and 2p+1 of src into dst; an odd last run is copied.
+static void sort_merge_pairs(void *ctx, int begin, int end) {
+    SortMergeLevel *ml = ctx;
+    SortJob *job = ml->job;
+    for (int p = begin; p < end; p++) {
+        if (atomic_load_explicit(&job->cancel, memory_order_relaxed)) return;
+        int lo = job->bounds[2 * p];
+        int mid = job->bounds[2 * p + 1 < ml->runs ? 2 * p + 1 : ml->runs];
+        int hi = job->bounds[2 * p + 2 < ml->runs ? 2 * p + 2 : ml->runs];
+        int a = lo, b = mid, o = lo;
+        while (a < mid && b < hi)
+            ml->dst[o++] = compare_keys(&job->view, &ml->src[b], &ml->src[a]) < 0 ? ml->src[b++] : ml->src[a++];
+        while (a < mid) ml->dst[o++] = ml->src[a++];
+        while (b < hi) ml->dst[o++] = ml->src[b++];
+    }
+}
+
+static void *sort_job_main(void *arg) {
+    SortJob *job = arg;
+    int workers = sort_worker_count();
+    parallel_for(job->pieces, 1, workers, sort_pieces, job);
+    SortKey *src = job->keys, *dst = job->tmp;
+    int runs = job->pieces;
+    while (runs > 1 && !atomic_load(&job->cancel)) {
+        SortMergeLevel ml = { .job = job, .src = src, .dst = dst, .runs = runs };
+        int pairs = (runs + 1) / 2;
+        parallel_for(pairs, 1, workers, sort_merge_pairs, &ml);
+        for (int p = 0; p <= pairs; p++) job->bounds[p] = job->bounds[2 * p < runs ? 2 * p : runs];
+        runs = pairs;
+        SortKey *t = src; src = dst; dst = t;
+    }
+    job->sorted = src;
+    atomic_store(&job->done, 1);
+    return NULL;
+}
+
+// Rearrange k[lo, hi) so k[nth] holds the key that sorts there, with
+// nothing after it sorting earlier and nothing before it sorting later.
+static void select_keys(const FileList *list, SortKey *k, int lo, int hi, int nth) {
+    while (hi - lo > 16) {
+        int mid = lo + (hi - lo) / 2;
+        SortKey t;
+        if (compare_keys(list, &k[mid], &k[lo]) < 0) { t = k[mid]; k[mid] = k[lo]; k[lo] = t; }
+        if (compare_keys(list, &k[hi - 1], &k[lo]) < 0) { t = k[hi - 1]; k[hi - 1] = k[lo]; k[lo] = t; }
+        if (compare_keys(list, &k[hi - 1], &k[mid]) < 0) { t = k[hi - 1]; k[hi - 1] = k[mid]; k[mid] = t; }
+        SortKey pivot = k[mid];
+        int i = lo, j = hi - 1;
+        while (i <= j) {
+            while (compare_keys(list, &k[i], &pivot) < 0) i++;
+            while (compare_keys(list, &k[j], &pivot) > 0) j--;
+            if (i <= j) { t = k[i]; k[i] = k[j]; k[j] = t; i++; j--; }
+        }
+        if (nth <= j) hi = j + 1;
+        else if (nth >= i) lo = i;
+        else return;
+    }
+    merge_sort_keys(list, k, NULL, lo, hi);   // short ranges never touch tmp
+}
+
+// Order the first and last `window` rows exactly and hand the rest to a
+// background job. Returns -1 (order untouched) if the job can't start.
+static int sort_start(FileList *list, int window) {
+    int n = list->count;
+    SortJob *job = calloc(1, sizeof(*job));
+    SortKey *keys = malloc((size_t)n * 2 * sizeof(*keys));
+    if (!job || !keys) { free(job); free(keys); return -1; }
+    job->view = *list;
+    job->keys = keys;
+    job->tmp = keys + n;
+    job->n = n;
+    fill_sort_keys(list, list->order, keys, n);
+    select_keys(list, keys, 0, n, window);
+    select_keys(list, keys, window, n, n - window);
+    merge_sort_keys(list, keys, job->tmp, 0, window);
+    merge_sort_keys(list, keys, job->tmp, n - window, n);
+    for (int i = 0; i < n; i++) list->order[i] = keys[i].e;
+    if (list->sort_reverse) reverse_rows(list->order, n);
+    job->pieces = sort_worker_count();
+    for (int p = 0; p <= job->pieces; p++) job->bounds[p] = (int)((long long)n * p / job->pieces);
+    atomic_init(&job->cancel, 0);
+    atomic_init(&job->done, 0);
+    if (pthread_create(&job->thread, NULL, sort_job_main, job) != 0) {
+        // The ends are in place; finish the middle here instead.
+        sort_keys(list, keys, job->tmp, n);
+        for (int i = 0; i < n; i++) list->order[i] = keys[i].e;
+        if (list->sort_reverse) reverse_rows(list->order, n);
+        free(keys);
+        free(job);
+        return 0;
+    }
+    list->sorter = job;
+    return 0;
+}
+
+static void sort_job_free(SortJob *job) {
+    pthread_join(job->thread, NULL);
+    free(job->keys);
+    free(job);
+}
+
+// Drop an in-flight sort, leaving the order partially sorted; callers
+// are about to rebuild or replace it.
+static void sort_cancel(FileList *list) {
+    if (!list->sorter) return;
+    atomic_store(&list->sorter->cancel, 1);
+    sort_job_free(list->sorter);
+    list->sorter = NULL;
+}
+
+// Install a finished background sort (waiting for it if `wait`). The
+// cursor stays on its entry.
+static void sort_pump_wait(FileList *list, int wait) {
+    SortJob *job = list->sorter;
+    if (!job || (!wait && !atomic_load(&job->done))) return;
+    pthread_join(job->thread, NULL);
+    filter_levels_drop(list);
+    int has_sel = list->selected >= 0 && list->selected < list->count;
+    uint32_t sel = has_sel ? row_entry(list, list->selected) : 0;
+    for (int i = 0; i < job->n; i++) list->order[i] = job->sorted[i].e;
+    if (list->sort_reverse) reverse_rows(list->order, job->n);
+    for (int r = 0; has_sel && r < list->count; r++) {
+        if (list->order[r] == sel) { list->selected = r; break; }
+    }
+    free(job->keys);
+    free(job);
+    list->sorter = NULL;
+    scroll_to_selected(list, getmaxy(stdscr) - 3);
+}
+
+static void sort_pump(FileList *list) {
+    sort_pump_wait(list, 0);
+}
+
+// Sort list->order for display, in the background if the listing is huge.
+static void sort_items_portable(FileList *list) {
+    sort_cancel(list);
+    int window = SORT_WINDOW_ROWS;
+    int visible = getmaxy(stdscr) - 3;
+    if (2 * visible > window) window = 2 * visible;
+    if (list->count >= SORT_BACKGROUND_MIN && list->count > 4 * window &&
+        sort_start(list, window) == 0) return;
+    sort_rows(list, list->order, list->count);
+}
+
+// Recompute the rows from the loaded entries after a sort, filter or
+// hidden-files change. Only metadata the new sort needs and some entries
+// were loaded without is fetched; usually this makes no syscalls at all.
+// The cursor stays on its entry while that entry is still shown.
+static void rebuild_view(FileList *list) {
+    DirListing *d = &list->entries;
+    int has_sel = list->selected >= 0 && list->selected < list->count;
+    uint32_t sel = has_sel ? row_entry(list, list->selected) : 0;
+    sort_cancel(list);
+    filter_levels_drop(list);
+    if (list->dir_fd >= 0) stat_entries(list, d, list->dir_fd, 0, NULL);
+    if (list_reserve_order(list, d->count) != 0) return;
+    int n = 0;
+    for (int i = 0; i < d->count; i++) {
+        if (entry_visible(list, (uint32_t)i)) list->order[n++] = (uint32_t)i;
+    }
+    list->count = n;
+    sort_items_portable(list);
+    list->selected = 0;
+    for (int r = 0; has_sel && r < n; r++) {
+        if (list->order[r] == sel) { list->selected = r; break; }
+    }
+    scroll_to_selected(list, getmaxy(stdscr) - 3);
+}
+
+// Flip the sort direction. The order is already sorted, so reversing it
+// in place is enough.
+static void reverse_view(FileList *list) {
+    list->sort_reverse = !list->sort_reverse;
+    filter_levels_drop(list);
+    reverse_rows(list->order, list->count);
+    if (list->count > 0) list->selected = list->count - 1 - list->selected;
+    scroll_to_selected(list, getmaxy(stdscr) - 3);
+}
+
+// The live filter grew by one character: keep only the rows that still
+// match, after saving them for backspace. A narrower substring can only
+// match a subset, and the rows stay in sorted order, so nothing else is
+// tested or re-sorted.
+static void filter_narrow(FileList *list) {
+    sort_pump_wait(list, 1);
+    if (!list->filter_levels)
+        list->filter_levels = calloc(sizeof(list->filter_text), sizeof(*list->filter_levels));
+    uint32_t *rows = list->filter_levels ? malloc((size_t)list->count * sizeof(*rows) + 1) : NULL;
+    if (!rows) { rebuild_view(list); return; }
+    memcpy(rows, list->order, (size_t)list->count * sizeof(*rows));
+    list->filter_levels[list->filter_depth++] = (FilterLevel){ rows, list->count, list->selected };
+    const DirListing *d = &list->entries;
+    int new_sel = 0, w = 0;
+    for (int r = 0; r < list->count; r++) {
+        uint32_t e = list->order[r];
+        if (r == list->selected) new_sel = w;
+        if (passes_filter(list, entry_name(d, e), d->is_dir[e])) list->order[w++] = e;
+    }
+    list->count = w;
+    list->selected = new_sel < w ? new_sel : (w > 0 ? w - 1 : 0);
+    scroll_to_selected(list, getmaxy(stdscr) - 3);
+}
+
+// Undo the last `levels` narrowings, recomputing the rows if fewer were
+// saved. The cursor stays on its entry.
+static void filter_widen(FileList *list, int levels) {
+    if (list->filter_depth < levels || levels <= 0) {
+        rebuild_view(list);
+        return;
+    }
+    int has_sel = list->selected >= 0 && list->selected < list->count;
+    uint32_t sel = has_sel ? row_entry(list, list->selected) : 0;
+    while (levels-- > 1) free(list->filter_levels[--list->filter_depth].rows);
+    FilterLevel *l = &list->filter_levels[--list->filter_depth];
+    memcpy(list->order, l->rows, (size_t)l->count * sizeof(*l->rows));
+    list->count = l->count;
+    list->selected = l->selected;
+    for (int r = 0; has_sel && r < list->count; r++) {
+        if (list->order[r] == sel) { list->selected = r; break; }
+    }
+    free(l->rows);
+    l->rows = NULL;
+    scroll_to_selected(list, getmaxy(stdscr) - 3);
+}
+
+// ---- listing cache ----------------------------------------------------
+
+// Recently visited listings, keyed by directory identity and validated by
+// its mtime. Slots own their buffers; storing and restoring swaps them with
+// the FileList, so neither direction copies entries.
+typedef struct {
+    int used;
+    unsigned long last_use;
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime_ns;
+    DirListing entries;
+    uint32_t *order;
+    int order_cap;
+    int count;
+    int selected;
+    int scroll_offset;
+    // view the order was built for
+    int show_hidden;
+    SortMode sort_mode;
+    int sort_reverse;
+    FilterMode filter_mode;
+    char filter_text[256];
+} CachedListing;
+
+static CachedListing g_listing_cache[LISTING_CACHE_SLOTS];
+static unsigned long g_listing_cache_clock = 0;
+
+static int64_t stat_mtime_ns(const struct stat *st) {
+#if defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000LL + st->st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+
+static void swap_with_slot(FileList *list, CachedListing *c) {
+    DirListing tmp_entries = list->entries;
+    list->entries = c->entries;
+    c->entries = tmp_entries;
+    uint32_t *tmp_order = list->order;
+    list->order = c->order;
+    c->order = tmp_order;
+    int tmp = list->order_cap; list->order_cap = c->order_cap; c->order_cap = tmp;
+    tmp = list->count;         list->count = c->count;         c->count = tmp;
+    tmp = list->selected;      list->selected = c->selected;   c->selected = tmp;
+    tmp = list->scroll_offset; list->scroll_offset = c->scroll_offset; c->scroll_offset = tmp;
+}
+
+static void cache_slot_free(CachedListing *c) {
+    listing_free(&c->entries);
+    free(c->order);
+    memset(c, 0, sizeof(*c));
+}
+
+// Park a complete listing in the cache: the current one before leaving
+// it, or a prefetched one. The list gets the evicted slot's buffers back.
+static void cache_put(FileList *list) {
+    CachedListing *slot = NULL;
+    for (int i = 0; i < LISTING_CACHE_SLOTS && !slot; i++) {
+        CachedListing *c = &g_listing_cache[i];
+        if (c->used && c->dev == list->dir_dev && c->ino == list->dir_ino) slot = c;
+    }
+    for (int i = 0; i < LISTING_CACHE_SLOTS && !slot; i++) {
+        if (!g_listing_cache[i].used) slot = &g_listing_cache[i];
+    }
+    if (!slot) {
+        slot = &g_listing_cache[0];
+        for (int i = 1; i < LISTING_CACHE_SLOTS; i++) {
+            if (g_listing_cache[i].last_use < slot->last_use) slot = &g_listing_cache[i];
+        }
+    }
+    swap_with_slot(list, slot);
+    listing_reset(&list->entries);
+    list->count = 0;
+    slot->used = 1;
+    slot->last_use = ++g_listing_cache_clock;
+    slot->dev = list->dir_dev;
+    slot->ino = list->dir_ino;
+    slot->mtime_ns = list->dir_mtime_ns;
+    slot->show_hidden = list->show_hidden;
+    slot->sort_mode = list->sort_mode;
+    slot->sort_reverse = list->sort_reverse;
+    slot->filter_mode = list->filter_mode;
+    memcpy(slot->filter_text, list->filter_text, sizeof(slot->filter_text));
+    // Keep the total bounded: drop the oldest other listings outright.
+    for (;;) {
+        long total = 0;
+        CachedListing *oldest = NULL;
+        for (int i = 0; i < LISTING_CACHE_SLOTS; i++) {
+            CachedListing *c = &g_listing_cache[i];
+            if (!c->used) continue;
+            total += c->entries.count;
+            if (c != slot && (!oldest || c->last_use < oldest->last_use)) oldest = c;
+        }
+        if (total <= LISTING_CACHE_MAX_ENTRIES || !oldest) break;
+        cache_slot_free(oldest);
+    }
+}
+
+// Restore the cached listing for the directory described by st, if it is
+// still current. Entries are cached unfiltered, so a listing left under
+// another view only needs its rows rebuilt. Returns 1 on a hit.
+static int cache_take(FileList *list, const struct stat *st) {
+    for (int i = 0; i < LISTING_CACHE_SLOTS; i++) {
+        CachedListing *c = &g_listing_cache[i];
+        if (!c->used || c->dev != st->st_dev || c->ino != st->st_ino) continue;
+        if (c->mtime_ns != stat_mtime_ns(st)) return 0;
+        int same_view = c->show_hidden == list->show_hidden &&
+                        c->sort_mode == list->sort_mode &&
+                        c->sort_reverse == list->sort_reverse &&
+                        c->filter_mode == list->filter_mode &&
+                        strcmp(c->filter_text, list->filter_text) == 0;
+        swap_with_slot(list, c);
+        c->used = 0;
+        if (!same_view) rebuild_view(list);
+        return 1;
+    }
+    return 0;
+}
+
+static void listing_cache_free(void) {
+    for (int i = 0; i < LISTING_CACHE_SLOTS; i++) cache_slot_free(&g_listing_cache[i]);
+}
+
+// ---- prefetch ---------------------------------------------------------
+
+// When the cursor rests on a directory for PREFETCH_IDLE_MS, read it on a
+// low-priority thread exactly as load_directory would and park the result
+// in the listing cache, so entering it is a cache hit. Moving the cursor
+// cancels the read; directories past PREFETCH_MAX_ENTRIES are skipped.
+typedef struct Prefetch {
+    pthread_t thread;
+    FileList view;            // settings snapshot; entries and order hold the result
+    int parent_fd;            // the list's dir_fd, kept open until this is joined
+    char name[256];
+    char path[MAX_PATH];
+    int ncached;              // identities already in the cache when started
+    dev_t cached_dev[LISTING_CACHE_SLOTS];
+    ino_t cached_ino[LISTING_CACHE_SLOTS];
+    int64_t cached_mtime_ns[LISTING_CACHE_SLOTS];
+    atomic_int cancel;
+    atomic_int done;
+    int ok;                   // view holds a complete listing
+} Prefetch;
+
+static void *prefetch_main(void *arg) {
+    Prefetch *job = arg;
+#ifdef __linux__
+    // Stay out of the way of the UI and of real loads: lowest CPU
+    // priority we can set without privileges, idle I/O class.
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), PREFETCH_NICE);
+#ifdef SYS_ioprio_set
+    syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+#endif
+#endif
+    FileList *view = &job->view;
+    DirListing *d = &view->entries;
+    struct stat st;
+    int fd = openat(job->parent_fd, job->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) goto out;
+    for (int i = 0; i < job->ncached; i++) {
+        if (job->cached_dev[i] == st.st_dev && job->cached_ino[i] == st.st_ino &&
+            job->cached_mtime_ns[i] == stat_mtime_ns(&st)) goto out;
+    }
+    view->dir_dev = st.st_dev;
+    view->dir_ino = st.st_ino;
+    view->dir_mtime_ns = stat_mtime_ns(&st);
+    DirReader reader;
+    if (dir_reader_open(&reader, fd) != 0) goto out;
+    int more;
+    do {
+        int first = d->count;
+        more = dir_reader_next(&reader, d, GETDENTS_BUF_SIZE);
+        if (d->count > PREFETCH_MAX_ENTRIES) more = -1;
+        if (more >= 0) stat_entries(view, d, fd, first, &job->cancel);
+    } while (more > 0 && !atomic_load(&job->cancel));
+    dir_reader_close(&reader);
+    if (more != 0 || atomic_load(&job->cancel)) goto out;
+    if (list_reserve_order(view, d->count) != 0) goto out;
+    int n = 0;
+    for (int i = 0; i < d->count; i++) {
+        if (entry_visible(view, (uint32_t)i)) view->order[n++] = (uint32_t)i;
+    }
+    view->count = n;
+    sort_rows(view, view->order, n);
+    job->ok = 1;
+out:
+    if (fd >= 0) close(fd);
+    atomic_store(&job->done, 1);
+    return NULL;
+}
+
+static void prefetch_start(FileList *list, uint32_t e) {
+    Prefetch *job = calloc(1, sizeof(*job));
+    if (!job) return;
+    // Same spelling as the path handle_input() will load.
+    if (entry_full_path(list, e, job->path, sizeof(job->path)) != 0) { free(job); return; }
+    job->view = *list;
+    job->view.entries = (DirListing){0};
+    job->view.watch_pending = (DirListing){0};
+    job->view.order = NULL;
+    job->view.order_cap = 0;
+    job->view.count = 0;
+    job->view.selected = 0;
+    job->view.scroll_offset = 0;
+    job->view.loader = NULL;
+    job->view.sorter = NULL;
+    job->view.prefetch = NULL;
+    job->parent_fd = list->dir_fd;
+    snprintf(job->name, sizeof(job->name), "%s", entry_name(&list->entries, e));
+    for (int i = 0; i < LISTING_CACHE_SLOTS; i++) {
+        const CachedListing *c = &g_listing_cache[i];
+        if (!c->used) continue;
+        job->cached_dev[job->ncached] = c->dev;
+        job->cached_ino[job->ncached] = c->ino;
+        job->cached_mtime_ns[job->ncached] = c->mtime_ns;
+        job->ncached++;
+    }
+    atomic_init(&job->cancel, 0);
+    atomic_init(&job->done, 0);
+    if (pthread_create(&job->thread, NULL, prefetch_main, job) != 0) {
+        free(job);
+        return;
+    }
+    list->prefetch = job;
+}
+
+// Join the prefetch; `keep` parks a complete result in the cache.
+static void prefetch_finish(FileList *list, int keep) {
+    Prefetch *job = list->prefetch;
+    if (!job) return;
+    if (!keep) atomic_store(&job->cancel, 1);
+    pthread_join(job->thread, NULL);
+    if (keep && job->ok) cache_put(&job->view);
+    listing_free(&job->view.entries);
+    free(job->view.order);
+    free(job);
+    list->prefetch = NULL;
+}
+
+static void prefetch_cancel(FileList *list) {
+    prefetch_finish(list, 0);
+}
+
+// Entering a directory: a prefetch of that very directory is worth
+// waiting for, any other one is dropped.
+static void prefetch_settle(FileList *list, const char *path) {
+    if (list->prefetch) prefetch_finish(list, strcmp(list->prefetch->path, path) == 0);
+    list->prefetch_name[0] = '\0';
+    list->prefetch_started = 0;
+}
+
+// The directory under the cursor, if there is one worth prefetching.
+static const char *prefetch_target(const FileList *list) {
+    if (list->dir_fd < 0 || list->selected < 0 || list->selected >= list->count) return NULL;
+    uint32_t e = row_entry(list, list->selected);
+    if (!list->entries.is_dir[e] || !(list->entries.meta[e] & META_TYPE)) return NULL;
+    const char *name = entry_name(&list->entries, e);
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return NULL;
+    return name;
+}
+
+// Called every loop iteration: restart the idle clock when the cursor
+// moves, start a prefetch once it has rested, collect finished ones.
+static void prefetch_pump(FileList *list) {
+    const char *name = prefetch_target(list);
+    if (strcmp(name ? name : "", list->prefetch_name) != 0) {
+        prefetch_cancel(list);
+        snprintf(list->prefetch_name, sizeof(list->prefetch_name), "%s", name ? name : "");
+        clock_gettime(CLOCK_MONOTONIC, &list->prefetch_since);
+        list->prefetch_started = 0;
+        return;
+    }
+    if (list->prefetch) {
+        if (atomic_load(&list->prefetch->done)) prefetch_finish(list, 1);
+        return;
+    }
+    if (!name || list->prefetch_started || list->loader || list->sorter) return;
+    if (elapsed_ms(&list->prefetch_since) < PREFETCH_IDLE_MS) return;
+    list->prefetch_started = 1;
+    prefetch_start(list, row_entry(list, list->selected));
+}
+
+// Milliseconds until prefetch_pump() has work, or -1.
+static int prefetch_timeout_ms(const FileList *list) {
+    if (list->prefetch) return BACKGROUND_TICK_MS;
+    if (!list->prefetch_name[0] || list->prefetch_started) return -1;
+    double left = PREFETCH_IDLE_MS - elapsed_ms(&list->prefetch_since);
+    return left <= 0 ? 0 : (int)left + 1;
+}
+
+// ---- preview pane -----------------------------------------------------
+
+// With `i` the right half of the screen previews the highlighted entry:
+// the head of a text file, a hex dump of a binary one, or a directory's
+// children. Previews are built on a thread once the cursor rests for
+// PREVIEW_IDLE_MS, and the last PREVIEW_SLOTS are kept keyed by path, size
+// and mtime, so coming back to an entry draws it at once. Moving away from
+// an entry abandons its job instead of joining it; the thread frees itself
+// when its read returns, so a slow disk never holds up navigation.
+typedef struct {
+    char path[MAX_PATH];
+    off_t size;          // files: from the listing, so a lookup needs no I/O
+    int64_t mtime_ns;    // directories: stat'ed, the listing's is stale or absent
+    int is_dir;
+    int show_hidden;     // directories: whether dot entries are listed
+} PreviewKey;
+
+typedef struct {
+    PreviewKey key;
+    uint64_t key_hash;   // preview_key_hash(&key), what draw_preview() looks up
+    unsigned long last_use;   // 0 = empty slot
+    char *text;          // the lines, each ending in '\n'
+    uint64_t hash;       // of key and text, for the screen shadow
+} PreviewSlot;
+
+static PreviewSlot g_previews[PREVIEW_SLOTS];
+static unsigned long g_preview_clock = 0;
+static atomic_int g_preview_jobs;   // threads still running, abandoned ones too
+
+enum { PREVIEW_RUNNING, PREVIEW_DONE, PREVIEW_ABANDONED };
+
+typedef struct PreviewJob {
+    pthread_t thread;
+    PreviewKey key;
+    atomic_int cancel;
+    atomic_int state;    // whichever side moves it last frees the job
+    char *text;
+    size_t len;
+    size_t cap;
+    int nlines;
+} PreviewJob;
+
+// Append one line, dropping control characters and expanding tabs.
+static void preview_line(PreviewJob *job, const char *s, size_t n) {
+    if (job->nlines >= PREVIEW_LINES) return;
+    if (job->cap - job->len < PREVIEW_LINE_MAX + 2) {
+        size_t cap = job->cap ? job->cap * 2 : 4096;
+        char *text = realloc(job->text, cap);
+        if (!text) return;
+        job->text = text;
+        job->cap = cap;
+    }
+    char *out = job->text + job->len;
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        // stop at a character boundary, never inside a UTF-8 sequence
+        if (len >= PREVIEW_LINE_MAX - 8 && ((c & 0xC0) != 0x80 || len >= PREVIEW_LINE_MAX - 1)) break;
+        if (c == '\t') {
+            do out[len++] = ' '; while (len % 8);
+        } else if (c == '\r') {
+            continue;
+        } else {
+            out[len++] = (c < 0x20 || c == 0x7f) ? '.' : (char)c;
+        }
+    }
+    out[len++] = '\n';
+    out[len] = '\0';
+    job->len += len;
+    job->nlines++;
+}
+
+static void preview_note(PreviewJob *job, const char *what, int err) {
+    char line[256];
+    int n = err ? snprintf(line, sizeof(line), "(%s: %s)", what, strerror(err))
+                : snprintf(line, sizeof(line), "(%s)", what);
+    preview_line(job, line, (size_t)n);
+}
+
+static int preview_name_cmp(const void *a, const void *b) {
+    return strcasecmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Children sorted by name, directories marked with a trailing '/'.
+static void preview_dir(PreviewJob *job) {
+    DIR *dir = opendir(job->key.path);
+    if (!dir) { preview_note(job, "cannot open", errno); return; }
+    char **names = malloc(PREVIEW_DIR_MAX * sizeof(*names));
+    int n = 0, more = 0;
+    struct dirent *de;
+    while (names && (de = readdir(dir)) != NULL) {
+        if (atomic_load_explicit(&job->cancel, memory_order_relaxed)) break;
+        const char *name = de->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (name[0] == '.' && !job->key.show_hidden) continue;
+        if (n == PREVIEW_DIR_MAX) { more = 1; break; }
+        size_t len = strlen(name);
+        char *copy = malloc(len + 2);
+        if (!copy) break;
+        memcpy(copy, name, len);
+        copy[len] = de->d_type == DT_DIR ? '/' : '\0';
+        copy[len + 1] = '\0';
+        names[n++] = copy;
+    }
+    closedir(dir);
+    if (names) qsort(names, (size_t)n, sizeof(*names), preview_name_cmp);
+    for (int i = 0; i < n; i++) {
+        preview_line(job, names[i], strlen(names[i]));
+        free(names[i]);
+    }
+    free(names);
+    if (more) preview_note(job, "more not shown", 0);
+    else if (n == 0) preview_note(job, "empty", 0);
+}
+
+static void preview_hex(PreviewJob *job, const unsigned char *p, size_t n) {
+    for (size_t off = 0; off < n && job->nlines < PREVIEW_LINES; off += 8) {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "%08zx ", off);
+        for (size_t j = 0; j < 8; j++) {
+            if (off + j < n) len += snprintf(line + len, sizeof(line) - (size_t)len, " %02x", p[off + j]);
+            else len += snprintf(line + len, sizeof(line) - (size_t)len, "   ");
+        }
+        line[len++] = ' ';
+        line[len++] = ' ';
+        for (size_t j = 0; j < 8 && off + j < n; j++)
+            line[len++] = isprint(p[off + j]) ? (char)p[off + j] : '.';
+        preview_line(job, line, (size_t)len);
+    }
+}
+
+static void preview_file(PreviewJob *job) {
+    // never open devices or FIFOs just to look at them
+    struct stat st;
+    if (stat(job->key.path, &st) != 0) { preview_note(job, "cannot stat", errno); return; }
+    if (!S_ISREG(st.st_mode)) { preview_note(job, "not a regular file", 0); return; }
+    int fd = open(job->key.path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) { preview_note(job, "cannot open", errno); return; }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) { preview_note(job, "cannot stat", errno); close(fd); return; }
+    if (st.st_size == 0) { preview_note(job, "empty", 0); close(fd); return; }
+    // Read, not mapped: a file truncated under a mapping would raise
+    // SIGBUS, and at this size a copy costs nothing.
+    unsigned char *head = malloc(PREVIEW_BYTES);
+    if (!head) { close(fd); return; }
+    size_t n = 0;
+    int err = 0;
+    while (n < PREVIEW_BYTES) {
+        ssize_t got = pread(fd, head + n, PREVIEW_BYTES - n, (off_t)n);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) err = errno;
+        if (got <= 0) break;
+        n += (size_t)got;
+    }
+    close(fd);
+    if (n == 0) {
+        if (err) preview_note(job, "cannot read", err);
+        else preview_note(job, "empty", 0);
+        free(head);
+        return;
+    }
+    if (atomic_load(&job->cancel)) { free(head); return; }
+    if (memchr(head, 0, n < PREVIEW_SNIFF ? n : PREVIEW_SNIFF)) {
+        preview_hex(job, head, n);
+    } else {
+        size_t end = n;
+        // a head cut short ends in a partial line; leave it out
+        if (n == PREVIEW_BYTES && n < (size_t)st.st_size) {
+            while (end > 0 && head[end - 1] != '\n') end--;
+            if (end == 0) end = n;
+        }
+        const unsigned char *p = head, *stop = head + end;
+        while (p < stop && job->nlines < PREVIEW_LINES) {
+            const unsigned char *nl = memchr(p, '\n', (size_t)(stop - p));
+            const unsigned char *eol = nl ? nl : stop;
+            preview_line(job, (const char *)p, (size_t)(eol - p));
+            p = eol + 1;
+        }
+    }
+    free(head);
+}
+
+static void preview_job_free(PreviewJob *job) {
+    free(job->text);
+    free(job);
+}
+
+static void *preview_main(void *arg) {
+    PreviewJob *job = arg;
+    if (job->key.is_dir) preview_dir(job);
+    else preview_file(job);
+    atomic_fetch_sub(&g_preview_jobs, 1);
+    if (atomic_exchange(&job->state, PREVIEW_DONE) == PREVIEW_ABANDONED) preview_job_free(job);
+    return NULL;
+}
+
+static uint64_t preview_key_hash(const PreviewKey *key) {
+    uint64_t h = hash_bytes(key->path, strlen(key->path));
+    h ^= hash_bytes((const char *)&key->size, sizeof(key->size)) * 31;
+    h ^= hash_bytes((const char *)&key->mtime_ns, sizeof(key->mtime_ns)) * 37;
+    h ^= (uint64_t)(key->is_dir * 2 + key->show_hidden) * 41;
+    return h ? h : 1;
+}
+
+static int preview_key_same(const PreviewKey *a, const PreviewKey *b) {
+    return a->size == b->size && a->mtime_ns == b->mtime_ns && a->is_dir == b->is_dir &&
+           a->show_hidden == b->show_hidden && strcmp(a->path, b->path) == 0;
+}
+
+// The highlighted entry as a preview key. Files are keyed from what the
+// listing already knows; a directory's listed mtime is missing in the name
+// and ext views and is not refreshed when its contents change, since only
+// the current directory is watched, so directories get one fstatat().
+// Returns -1 when there is nothing to preview.
+static int preview_key(const FileList *list, PreviewKey *key) {
+    if (list->selected < 0 || list->selected >= list->count) return -1;
+    uint32_t e = row_entry(list, list->selected);
+    const DirListing *d = &list->entries;
+    if (entry_full_path(list, e, key->path, sizeof(key->path)) != 0) return -1;
+    key->size = (d->meta[e] & META_SIZE) ? d->size[e] : -1;
+    key->mtime_ns = (d->meta[e] & META_MTIME) ? (int64_t)d->mtime[e] * 1000000000 : 0;
+    key->is_dir = d->is_dir[e];
+    if (key->is_dir) {
+        struct stat st;
+        key->mtime_ns = fstatat(list->dir_fd, d->names + d->name_off[e], &st, 0) == 0 ? stat_mtime_ns(&st) : 0;
+    }
+    key->show_hidden = key->is_dir ? list->show_hidden : 0;
+    return 0;
+}
+
+static PreviewSlot *preview_lookup(const PreviewKey *key) {
+    for (int i = 0; i < PREVIEW_SLOTS; i++) {
+        PreviewSlot *p = &g_previews[i];
+        if (p->last_use && preview_key_same(&p->key, key)) {
+            p->last_use = ++g_preview_clock;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// The slot for a key preview_pump() already computed, without redoing
+// its I/O.
+static PreviewSlot *preview_lookup_hash(uint64_t key_hash) {
+    for (int i = 0; i < PREVIEW_SLOTS; i++) {
+        PreviewSlot *p = &g_previews[i];
+        if (p->last_use && p->key_hash == key_hash) {
+            p->last_use = ++g_preview_clock;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Move a finished job's text into the least recently used slot.
+static void preview_store(PreviewJob *job) {
+    PreviewSlot *slot = &g_previews[0];
+    for (int i = 1; i < PREVIEW_SLOTS && slot->last_use; i++) {
+        if (g_previews[i].last_use < slot->last_use) slot = &g_previews[i];
+    }
+    free(slot->text);
+    memset(slot, 0, sizeof(*slot));
+    if (!job->text) return;
+    slot->key = job->key;
+    slot->text = job->text;
+    job->text = NULL;
+    slot->key_hash = preview_key_hash(&slot->key);
+    slot->hash = slot->key_hash ^ hash_bytes(slot->text, job->len);
+    if (slot->hash <= 2) slot->hash = 3;
+    slot->last_use = ++g_preview_clock;
+}
+
+static void preview_cache_free(void) {
+    for (int i = 0; i < PREVIEW_SLOTS; i++) free(g_previews[i].text);
+    memset(g_previews, 0, sizeof(g_previews));
+}
+
+static void preview_start(FileList *list, const PreviewKey *key) {
+    PreviewJob *job = calloc(1, sizeof(*job));
+    if (!job) return;
+    job->key = *key;
+    atomic_init(&job->cancel, 0);
+    atomic_init(&job->state, PREVIEW_RUNNING);
+    atomic_fetch_add(&g_preview_jobs, 1);
+    if (pthread_create(&job->thread, NULL, preview_main, job) != 0) {
+        atomic_fetch_sub(&g_preview_jobs, 1);
+        free(job);
+        return;
+    }
+    list->preview = job;
+}
+
+// Let go of the in-flight job without waiting for it.
+static void preview_drop(FileList *list) {
+    PreviewJob *job = list->preview;
+    if (!job) return;
+    list->preview = NULL;
+    atomic_store(&job->cancel, 1);
+    pthread_detach(job->thread);
+    if (atomic_exchange(&job->state, PREVIEW_ABANDONED) == PREVIEW_DONE) preview_job_free(job);
+}
+
+// Called every loop iteration, like prefetch_pump(): restart the idle
+// clock when the selection changes, build a missing preview once the
+// cursor has rested, collect the finished one.
+static void preview_pump(FileList *list) {
+    if (!list->preview_on) {
+        preview_drop(list);
+        list->preview_want = 0;
+        return;
+    }
+    PreviewKey key;
+    uint64_t want = preview_key(list, &key) == 0 ? preview_key_hash(&key) : 0;
+    if (want != list->preview_want) {
+        preview_drop(list);
+        list->preview_want = want;
+        clock_gettime(CLOCK_MONOTONIC, &list->preview_since);
+        list->preview_started = 0;
+        return;
+    }
+    PreviewJob *job = list->preview;
+    if (job) {
+        if (atomic_load(&job->state) != PREVIEW_DONE) return;
+        pthread_join(job->thread, NULL);
+        preview_store(job);
+        preview_job_free(job);
+        list->preview = NULL;
+        return;
+    }
+    if (!want || list->preview_started) return;
+    if (preview_lookup(&key)) { list->preview_started = 1; return; }
+    if (elapsed_ms(&list->preview_since) < PREVIEW_IDLE_MS) return;
+    if (atomic_load(&g_preview_jobs) >= PREVIEW_JOBS_MAX) return;   // stuck reads; retry later
+    list->preview_started = 1;
+    preview_start(list, &key);
+}
+
+// Milliseconds until preview_pump() has work, or -1.
+static int preview_timeout_ms(const FileList *list) {
+    if (!list->preview_on) return -1;
+    if (list->preview) return PREVIEW_TICK_MS;
+    if (!list->preview_want || list->preview_started) return -1;
+    double left = PREVIEW_IDLE_MS - elapsed_ms(&list->preview_since);
+    if (left > 0) return (int)left + 1;
+    return atomic_load(&g_preview_jobs) >= PREVIEW_JOBS_MAX ? BACKGROUND_TICK_MS : 0;
+}
+
+// Columns [x, x + w) of the list rows, with a rule down column x.
+static void draw_preview(FileList *list, int x, int w, int h) {
+    const PreviewSlot *p = list->preview_want ? preview_lookup_hash(list->preview_want) : NULL;
+    const char *text = p ? p->text : list->preview ? "…\n" : "";
+    uint64_t hash = p ? p->hash : list->preview ? 2 : 1;
+    if (list->shown.pane == hash) return;
+    list->shown.pane = hash;
+    attron(COLOR_PAIR(4));
+    mvvline(0, x, ACS_VLINE, h);
+    attroff(COLOR_PAIR(4));
+    for (int i = 0; i < h; i++) {
+        move(i, x + 1);
+        clrtoeol();
+        if (!*text) continue;
+        const char *nl = strchr(text, '\n');
+        size_t len = nl ? (size_t)(nl - text) : strlen(text);
+        // bytes never undercount columns, so this cannot wrap
+        if (w > 2) mvaddnstr(i, x + 2, text, len < (size_t)(w - 2) ? (int)len : w - 2);
+        text += nl ? len + 1 : len;
+    }
+}
+
+// ---- disk usage -------------------------------------------------------
+
+// Recursive allocated size (st_blocks) of every subdirectory, for
+// SORT_DU. A pool of walkers shares one stack of directories to read;
+// each directory is charged to the top-level entry it was found under,
+// and that entry's total is posted as soon as its whole subtree is done.
+// Like du -x the walk stays on the filesystem it starts on, and a file
+// with several links is only counted once per walk.
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int64_t bytes;
+} DuLink;
+
+// Memo of every directory walked, kept across walks and navigations. A
+// directory whose mtime is unchanged still has the same names, so its
+// own bytes are reused and only its subdirectories are opened again.
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime_ns;
+    int64_t own_bytes;      // the directory itself plus singly-linked files
+    uint32_t link_first;    // multiply-linked files, in g_du_links
+    uint32_t link_count;
+} DuNode;
+
+static pthread_mutex_t g_du_lock = PTHREAD_MUTEX_INITIALIZER;
+static DuNode *g_du_nodes;
+static uint32_t g_du_count, g_du_cap;
+static uint32_t *g_du_index;        // node + 1, 0 = empty
+static uint32_t g_du_index_cap;     // power of two
+static DuLink *g_du_links;
+static uint32_t g_du_links_len, g_du_links_cap;
+
+static uint32_t du_hash(dev_t dev, ino_t ino) {
+    uint64_t h = (uint64_t)ino * 0x9E3779B97F4A7C15ULL ^ (uint64_t)dev;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// Slot for (dev, ino) in g_du_index: its node, or the empty slot for it.
+static uint32_t du_slot(dev_t dev, ino_t ino) {
+    uint32_t mask = g_du_index_cap - 1;
+    uint32_t h = du_hash(dev, ino) & mask;
+    while (g_du_index[h]) {
+        const DuNode *n = &g_du_nodes[g_du_index[h] - 1];
+        if (n->dev == dev && n->ino == ino) break;
+        h = (h + 1) & mask;
+    }
+    return h;
+}
+
+static void du_memo_clear(void) {
+    g_du_count = 0;
+    g_du_links_len = 0;
+    if (g_du_index) memset(g_du_index, 0, g_du_index_cap * sizeof(*g_du_index));
+}
+
+// Look up a directory. On a hit, *links is a malloc'ed copy of its
+// multiply-linked files. Returns 1 on a hit with the same mtime.
+static int du_memo_get(const struct stat *st, int64_t *own, DuLink **links, uint32_t *nlinks) {
+    int hit = 0;
+    pthread_mutex_lock(&g_du_lock);
+    if (g_du_index_cap) {
+        uint32_t h = du_slot(st->st_dev, st->st_ino);
+        const DuNode *n = g_du_index[h] ? &g_du_nodes[g_du_index[h] - 1] : NULL;
+        if (n && n->mtime_ns == stat_mtime_ns(st)) {
+            *own = n->own_bytes;
+            *nlinks = n->link_count;
+            *links = NULL;
+            if (n->link_count) {
+                *links = malloc(n->link_count * sizeof(**links));
+                if (*links) memcpy(*links, g_du_links + n->link_first, n->link_count * sizeof(**links));
+            }
+            hit = !n->link_count || *links;
+        }
+    }
+    pthread_mutex_unlock(&g_du_lock);
+    return hit;
+}
+
+static void du_memo_put(const struct stat *st, int64_t own, const DuLink *links, uint32_t nlinks) {
+    pthread_mutex_lock(&g_du_lock);
+    if (g_du_count >= DU_MEMO_MAX_DIRS || g_du_links_len + nlinks > DU_MEMO_MAX_DIRS) du_memo_clear();
+    if ((g_du_count + 1) * 2 > g_du_index_cap) {
+        uint32_t cap = g_du_index_cap ? g_du_index_cap * 2 : 1024;
+        uint32_t *index = calloc(cap, sizeof(*index));
+        if (!index) goto out;
+        free(g_du_index);
+        g_du_index = index;
+        g_du_index_cap = cap;
+        for (uint32_t i = 0; i < g_du_count; i++)
+            g_du_index[du_slot(g_du_nodes[i].dev, g_du_nodes[i].ino)] = i + 1;
+    }
+    if (g_du_count == g_du_cap) {
+        uint32_t cap = g_du_cap ? g_du_cap * 2 : 1024;
+        DuNode *nodes = realloc(g_du_nodes, cap * sizeof(*nodes));
+        if (!nodes) goto out;
+        g_du_nodes = nodes;
+        g_du_cap = cap;
+    }
+    if (g_du_links_len + nlinks > g_du_links_cap) {
+        uint32_t cap = g_du_links_cap ? g_du_links_cap : 256;
+        while (cap < g_du_links_len + nlinks) cap *= 2;
+        DuLink *l = realloc(g_du_links, cap * sizeof(*l));
+        if (!l) goto out;
+        g_du_links = l;
+        g_du_links_cap = cap;
+    }
+    uint32_t h = du_slot(st->st_dev, st->st_ino);
+    if (!g_du_index[h]) g_du_index[h] = ++g_du_count;
+    DuNode *n = &g_du_nodes[g_du_index[h] - 1];
+    n->dev = st->st_dev;
+    n->ino = st->st_ino;
+    n->mtime_ns = stat_mtime_ns(st);
+    n->own_bytes = own;
+    n->link_first = g_du_links_len;
+    n->link_count = nlinks;
+    if (nlinks) memcpy(g_du_links + g_du_links_len, links, nlinks * sizeof(*links));
+    g_du_links_len += nlinks;
+out:
+    pthread_mutex_unlock(&g_du_lock);
+}
+
+static void du_memo_free(void) {
+    free(g_du_nodes);
+    free(g_du_index);
+    free(g_du_links);
+    g_du_nodes = NULL;
+    g_du_index = NULL;
+    g_du_links = NULL;
+    g_du_count = g_du_cap = g_du_index_cap = g_du_links_len = g_du_links_cap = 0;
+}
+
+typedef struct DuItem {
+    struct DuItem *next;
+    int top;
+    char path[];            // relative to the walk's root
+} DuItem;
+
+typedef struct {
+    uint32_t entry;         // listing entry this total belongs to
+    int pending;            // directories of this subtree not yet read (lock)
+    atomic_llong bytes;
+} DuTop;
+
+typedef struct DuJob {
+    int root_fd;            // dup of the list's dir_fd
+    dev_t dev;
+    DuTop *tops;
+    int ntops;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    DuItem *stack;          // guarded by lock
+    int busy;               // walkers reading a directory (lock)
+    int *done;              // finished tops, in order (lock)
+    int ndone;              // (lock)
+    int taken;              // done[] entries already applied; UI thread only
+    DuLink *seen;           // multiply-linked files counted so far (seen_lock)
+    uint32_t seen_cap, seen_used;
+    pthread_mutex_t seen_lock;
+    atomic_int cancel;
+    int nthreads;
+    pthread_t threads[STAT_WORKERS_MAX];
+} DuJob;
+
+// Count a multiply-linked file unless this walk has seen it already.
+static int64_t du_link_bytes(DuJob *job, const DuLink *l) {
+    int64_t bytes = 0;
+    pthread_mutex_lock(&job->seen_lock);
+    if ((job->seen_used + 1) * 2 > job->seen_cap) {
+        uint32_t cap = job->seen_cap ? job->seen_cap * 2 : 256;
+        DuLink *seen = calloc(cap, sizeof(*seen));
+        if (!seen) goto out;
+        for (uint32_t i = 0; i < job->seen_cap; i++) {
+            if (!job->seen[i].bytes) continue;
+            uint32_t h = du_hash(job->seen[i].dev, job->seen[i].ino) & (cap - 1);
+            while (seen[h].bytes) h = (h + 1) & (cap - 1);
+            seen[h] = job->seen[i];
+        }
+        free(job->seen);
+        job->seen = seen;
+        job->seen_cap = cap;
+    }
+    uint32_t h = du_hash(l->dev, l->ino) & (job->seen_cap - 1);
+    while (job->seen[h].bytes) {
+        if (job->seen[h].dev == l->dev && job->seen[h].ino == l->ino) goto out;
+        h = (h + 1) & (job->seen_cap - 1);
+    }
+    job->seen[h] = *l;
+    job->seen[h].bytes = 1;   // marks the slot used; the size goes to the caller
+    job->seen_used++;
+    bytes = l->bytes;
+out:
+    pthread_mutex_unlock(&job->seen_lock);
+    return bytes;
+}
+
+static DuItem *du_item(int top, const char *dir, const char *name) {
+    size_t a = strlen(dir), b = name ? strlen(name) : 0;
+    DuItem *it = malloc(sizeof(*it) + a + b + 2);
+    if (!it) return NULL;
+    it->top = top;
+    memcpy(it->path, dir, a);
+    if (name) {
+        it->path[a] = '/';
+        memcpy(it->path + a + 1, name, b);
+        it->path[a + 1 + b] = '\0';
+    } else {
+        it->path[a] = '\0';
+    }
+    return it;
+}
+
+// Read one directory: charge its bytes to its top and return its
+// subdirectories (as a list, count in *nsub).
+static DuItem *du_visit(DuJob *job, const DuItem *it, int *nsub) {
+    DuItem *subs = NULL;
+    *nsub = 0;
+    int fd = openat(job->root_fd, it->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_dev != job->dev) { close(fd); return NULL; }
+    int64_t own = 0;
+    DuLink *links = NULL;
+    uint32_t nlinks = 0, links_cap = 0;
+    int cached = du_memo_get(&st, &own, &links, &nlinks);
+    if (!cached) own = (int64_t)st.st_blocks * 512;
+    DirListing names = {0};
+    DirReader reader;
+    int more = -1;
+    if (dir_reader_open(&reader, fd) == 0) {
+        do more = dir_reader_next(&reader, &names, GETDENTS_BUF_SIZE);
+        while (more > 0 && !atomic_load_explicit(&job->cancel, memory_order_relaxed));
+        dir_reader_close(&reader);
+    }
+    for (int i = 0; i < names.count; i++) {
+        const char *name = entry_name(&names, (uint32_t)i);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        int is_dir = (names.meta[i] & META_TYPE) && names.is_dir[i];
+        // With an unchanged directory only subdirectories matter, and
+        // d_type already names them.
+        if (cached && (names.meta[i] & META_TYPE) && !is_dir) continue;
+        if (!is_dir || !cached) {
+            struct stat es;
+            if (fstatat(fd, name, &es, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            is_dir = S_ISDIR(es.st_mode);
+            if (!is_dir && !cached) {
+                if (es.st_nlink > 1) {
+                    if (nlinks == links_cap) {
+                        links_cap = links_cap ? links_cap * 2 : 16;
+                        DuLink *l = realloc(links, links_cap * sizeof(*l));
+                        if (!l) continue;
+                        links = l;
+                    }
+                    links[nlinks++] = (DuLink){ es.st_dev, es.st_ino, (int64_t)es.st_blocks * 512 };
+                } else {
+                    own += (int64_t)es.st_blocks * 512;
+                }
+            }
+        }
+        if (is_dir) {
+            DuItem *sub = du_item(it->top, it->path, name);
+            if (!sub) continue;
+            sub->next = subs;
+            subs = sub;
+            (*nsub)++;
+        }
+    }
+    listing_free(&names);
+    close(fd);
+    if (!cached && more == 0) du_memo_put(&st, own, links, nlinks);
+    int64_t bytes = own;
+    for (uint32_t k = 0; k < nlinks; k++) bytes += du_link_bytes(job, &links[k]);
+    free(links);
+    atomic_fetch_add(&job->tops[it->top].bytes, bytes);
+    return subs;
+}
+
+static void *du_worker(void *arg) {
+    DuJob *job = arg;
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        while (!job->stack && job->busy > 0 && !atomic_load(&job->cancel))
+            pthread_cond_wait(&job->cond, &job->lock);
+        if (atomic_load(&job->cancel) || !job->stack) break;
+        DuItem *it = job->stack;
+        job->stack = it->next;
+        job->busy++;
+        pthread_mutex_unlock(&job->lock);
+        int nsub;
+        DuItem *subs = du_visit(job, it, &nsub);
+        pthread_mutex_lock(&job->lock);
+        while (subs) {
+            DuItem *next = subs->next;
+            subs->next = job->stack;
+            job->stack = subs;
+            subs = next;
+        }
+        DuTop *top = &job->tops[it->top];
+        top->pending += nsub - 1;
+        if (top->pending == 0) job->done[job->ndone++] = it->top;
+        job->busy--;
+        if (nsub > 0 || job->busy == 0) pthread_cond_broadcast(&job->cond);
+        free(it);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static void du_job_free(DuJob *job) {
+    for (int i = 0; i < job->nthreads; i++) pthread_join(job->threads[i], NULL);
+    while (job->stack) {
+        DuItem *next = job->stack->next;
+        free(job->stack);
+        job->stack = next;
+    }
+    close(job->root_fd);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->cond);
+    pthread_mutex_destroy(&job->seen_lock);
+    free(job->seen);
+    free(job->done);
+    free(job->tops);
+    free(job);
+}
+
+static void du_cancel(FileList *list) {
+    DuJob *job = list->du;
+    if (!job) return;
+    pthread_mutex_lock(&job->lock);
+    atomic_store(&job->cancel, 1);
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    du_job_free(job);
+    list->du = NULL;
+}
+
+// Walk every subdirectory of the listing (hidden and filtered ones too,
+// so view changes need no new walk).
+static void du_start(FileList *list) {
+    du_cancel(list);
+    if (list->dir_fd < 0) return;
+    const DirListing *d = &list->entries;
+    DuJob *job = calloc(1, sizeof(*job));
+    if (!job) return;
+    job->tops = calloc((size_t)(d->count > 0 ? d->count : 1), sizeof(*job->tops));
+    job->done = malloc((size_t)(d->count > 0 ? d->count : 1) * sizeof(*job->done));
+    struct stat st;
+    job->root_fd = dup(list->dir_fd);
+    if (!job->tops || !job->done || job->root_fd < 0 || fstat(job->root_fd, &st) != 0) {
+        if (job->root_fd >= 0) close(job->root_fd);
+        free(job->tops);
+        free(job->done);
+        free(job);
+        return;
+    }
+    job->dev = st.st_dev;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->cond, NULL);
+    pthread_mutex_init(&job->seen_lock, NULL);
+    atomic_init(&job->cancel, 0);
+    for (int i = d->count - 1; i >= 0; i--) {
+        if (!d->is_dir[i] || (d->meta[i] & META_GONE)) continue;
+        const char *name = entry_name(d, (uint32_t)i);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        DuItem *it = du_item(job->ntops, name, NULL);
+        if (!it) continue;
+        DuTop *top = &job->tops[job->ntops++];
+        top->entry = (uint32_t)i;
+        top->pending = 1;
+        atomic_init(&top->bytes, 0);
+        it->next = job->stack;
+        job->stack = it;
+    }
+    int workers = stat_worker_count();
+    if (workers > job->ntops) workers = job->ntops;
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&job->threads[job->nthreads], NULL, du_worker, job) != 0) break;
+        job->nthreads++;
+    }
+    if (job->nthreads == 0) {
+        du_job_free(job);
+        return;
+    }
+    list->du = job;
+}
+
+// Apply finished totals; under SORT_DU their rows move into place.
+static void du_pump(FileList *list) {
+    DuJob *job = list->du;
+    if (!job || list->sorter) return;
+    pthread_mutex_lock(&job->lock);
+    int ndone = job->ndone;
+    pthread_mutex_unlock(&job->lock);
+    if (ndone > job->taken) {
+        DirListing *d = &list->entries;
+        uint32_t *fresh = malloc((size_t)(ndone - job->taken) * sizeof(*fresh));
+        int nf = 0;
+        for (int k = job->taken; k < ndone; k++) {
+            const DuTop *top = &job->tops[job->done[k]];
+            uint32_t e = top->entry;
+            d->du[e] = (int64_t)atomic_load(&top->bytes);
+            d->meta[e] = (unsigned char)((d->meta[e] | META_DU) & ~META_STYLE);
+            if (fresh && list->sort_mode == SORT_DU) {
+                d->meta[e] |= META_DIRTY;
+                fresh[nf++] = e;
+            }
+        }
+        job->taken = ndone;
+        if (nf > 0) reposition_entries(list, fresh, nf);
+        free(fresh);
+    }
+    if (job->taken == job->ntops) {
+        du_job_free(job);
+        list->du = NULL;
+    }
+}
+
+static void watch_directory(FileList *list);
+static void frecency_visit(const char *path, uint32_t weight);
+
+int load_directory(FileList *list, const char *path) {
+    // A listing still streaming in (or sorting) is incomplete and must not
+    // be cached.
+    int complete = (list->loader == NULL && list->sorter == NULL);
+    loader_cancel(list);
+    sort_cancel(list);
+    du_cancel(list);
+    filter_levels_drop(list);
+    list->filter_typing = 0;
+    prefetch_settle(list, path);
+    // Reloading the current directory rewinds the handle we already hold
+    // instead of resolving the path (and chdir'ing) all over again.
+    int reload = (list->dir_fd >= 0 && strcmp(path, list->cwd) == 0);
+    int fd;
+    struct stat st;
+    if (reload) {
+        fd = list->dir_fd;
+        if (lseek(fd, 0, SEEK_SET) < 0 || fstat(fd, &st) != 0) return -1;
+    } else {
+        fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return -1;
+        char resolved[MAX_PATH];
+        if (!realpath(path, resolved)) {
+            strncpy(resolved, path, MAX_PATH - 1);
+            resolved[MAX_PATH - 1] = '\0';
+        }
+        if (fstat(fd, &st) != 0 || fchdir(fd) != 0) { close(fd); return -1; }
+        if (complete && list->dir_fd >= 0) cache_put(list);
+        memcpy(list->cwd, resolved, MAX_PATH);
+        if (list->dir_fd >= 0) close(list->dir_fd);
+        list->dir_fd = fd;
+        frecency_visit(list->cwd, FRECENCY_VISIT);
+    }
+    // Watch before reading so nothing that changes mid-read is missed.
+    watch_directory(list);
+    // Identity is taken before reading, so a change made mid-read leaves
+    // the cached copy stale rather than wrongly fresh.
+    list->dir_dev = st.st_dev;
+    list->dir_ino = st.st_ino;
+    list->dir_mtime_ns = stat_mtime_ns(&st);
+    if (!reload && cache_take(list, &st)) {
+        if (list->sort_mode == SORT_DU) du_start(list);
+        return 0;
+    }
+    DirListing *d = &list->entries;
+    listing_reset(d);
+    list->count = 0;
+    list->selected = 0;
+    list->scroll_offset = 0;
+    DirReader reader;
+    if (dir_reader_open(&reader, fd) != 0) return -1;
+    // Read synchronously until the directory ends or the budget runs out;
+    // whatever is left streams in from a background thread.
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    int more;
+    size_t chunk = LOAD_FIRST_CHUNK;
+    do {
+        int first = d->count;
+        more = dir_reader_next(&reader, d, chunk);
+        if (more < 0) { dir_reader_close(&reader); return -1; }
+        stat_entries(list, d, fd, first, NULL);
+        chunk = GETDENTS_BUF_SIZE;
+    } while (more > 0 && elapsed_ms(&started) < LOAD_SYNC_BUDGET_MS);
+    if (more > 0 && loader_start(list, &reader) != 0) {
+        while (more > 0) {
+            int first = d->count;
+            more = dir_reader_next(&reader, d, GETDENTS_BUF_SIZE);
+            stat_entries(list, d, fd, first, NULL);
+        }
+    }
+    if (!list->loader) dir_reader_close(&reader);
+    if (list_reserve_order(list, d->count) != 0) return -1;
+    int n = 0;
+    for (int i = 0; i < d->count; i++) {
+        if (entry_visible(list, (uint32_t)i)) list->order[n++] = (uint32_t)i;
+    }
+    list->count = n;
+    sort_items_portable(list);
+    if (list->sort_mode == SORT_DU && !list->loader) du_start(list);
+    return 0;
+}
+
+// ---- live refresh -----------------------------------------------------
+
+// inotify reports names; patches re-stat each touched name once and move
+// just those entries, so a directory filling up never gets re-read. Event
+// bursts are collected for WATCH_COALESCE_MS and applied as one update.
+static void watch_directory(FileList *list) {
+    listing_reset(&list->watch_pending);
+    list->watch_due.tv_sec = 0;
+    list->watch_reload = 0;
+#ifdef __linux__
+    if (list->watch_fd < 0) return;
+    if (list->watch_wd >= 0) inotify_rm_watch(list->watch_fd, list->watch_wd);
+    list->watch_wd = inotify_add_watch(list->watch_fd, list->cwd,
+                                       IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                       IN_ATTRIB | IN_CLOSE_WRITE | IN_ONLYDIR | IN_EXCL_UNLINK);
+#endif
+}
+
+static void watch_read_events(FileList *list) {
+#ifdef __linux__
+    if (list->watch_fd < 0) return;
+    _Alignas(struct inotify_event) char buf[64 * 1024];
+    for (;;) {
+        ssize_t n = read(list->watch_fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) { list->watch_reload = 1; continue; }
+            if (ev->wd != list->watch_wd || ev->len == 0) continue;
+            if (list->watch_pending.count >= WATCH_PENDING_MAX) { list->watch_reload = 1; continue; }
+            listing_append(&list->watch_pending, ev->name, strlen(ev->name));
+        }
+    }
+    if ((list->watch_pending.count > 0 || list->watch_reload) && list->watch_due.tv_sec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &list->watch_due);
+        list->watch_due.tv_nsec += WATCH_COALESCE_MS * 1000000L;
+        if (list->watch_due.tv_nsec >= 1000000000L) {
+            list->watch_due.tv_sec++;
+            list->watch_due.tv_nsec -= 1000000000L;
+        }
+    }
+#else
+    (void)list;
+#endif
+}
+
+// Milliseconds until queued changes are due, or -1 if none are queued.
+static int watch_timeout_ms(const FileList *list) {
+    if (list->watch_due.tv_sec == 0) return -1;
+    double left = -elapsed_ms(&list->watch_due);
+    return left <= 0 ? 0 : (int)left + 1;
+}
+
+static void reload_keep_cursor(FileList *list) {
+    char name[256] = "";
+    if (list->selected >= 0 && list->selected < list->count) {
+        strncpy(name, row_name(list, list->selected), sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+    }
+    int selected = list->selected;
+    load_directory(list, list->cwd);
+    if (!name[0] || !select_entry_by_name(list, name)) {
+        list->selected = selected < list->count ? selected : (list->count > 0 ? list->count - 1 : 0);
+        if (list->selected < 0) list->selected = 0;
+    }
+    scroll_to_selected(list, getmaxy(stdscr) - 3);
+}
+
+// Re-stat each name in p and patch the listing to match: new entries are
+// inserted in sort order, changed ones re-positioned and vanished ones
+// dropped. Shared by live refresh and the file operations.
+//
+// When the watch saw no change before our fstat() of cwd other than those
+// in p, the patched listing is as current as a fresh read at that moment,
+// so it takes on that mtime and its cached copy stays trusted. Otherwise
+// the old mtime is kept and the copy is re-read on the next visit.
+static void apply_name_changes(FileList *list, const DirListing *p) {
+    sort_pump_wait(list, 1);
+    DirListing *d = &list->entries;
+    if (d->gone > 4096 + d->count / 2) {
+        reload_keep_cursor(list);
+        return;
+    }
+    uint32_t *fresh = malloc((size_t)(p->count > 0 ? p->count : 1) * sizeof(*fresh));
+    if (!fresh) { reload_keep_cursor(list); return; }
+    struct stat st;
+    int before = list->watch_pending.count;
+    int settled = list->watch_fd >= 0 && fstat(list->dir_fd, &st) == 0;
+    if (settled) {
+        watch_read_events(list);
+        settled = list->watch_pending.count == before && !list->watch_reload &&
+                  (before == 0 || p == &list->watch_pending);
+    }
+    const unsigned need = META_TYPE | META_SIZE | META_MTIME;
+    int nf = 0;
+    for (int k = 0; k < p->count; k++) {
+        const char *name = entry_name(p, (uint32_t)k);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        int i = listing_find(d, name);
+        if (i >= 0 && (d->meta[i] & META_DIRTY)) continue;
+        if (i < 0) {
+            i = listing_append(d, name, strlen(name));
+            if (i < 0) continue;
+        }
+        if (stat_entry_at(d, list->dir_fd, i, need) != 0 && (errno == ENOENT || errno == ENOTDIR)) {
+            d->meta[i] |= META_GONE | META_DIRTY;
+            d->gone++;
+        } else {
+            d->meta[i] |= META_DIRTY;
+        }
+        fresh[nf++] = (uint32_t)i;
+    }
+    reposition_entries(list, fresh, nf);
+    free(fresh);
+    if (settled) list->dir_mtime_ns = stat_mtime_ns(&st);
+}
+
+// Patch the listing after the file operations changed `name` (and, for a
+// rename, `other`), then put the cursor on `select` if it still exists.
+static void patch_entries(FileList *list, const char *name, const char *other, const char *select) {
+    DirListing names = {0};
+    listing_append(&names, name, strlen(name));
+    if (other) listing_append(&names, other, strlen(other));
+    apply_name_changes(list, &names);
+    listing_free(&names);
+    if (select) select_entry_by_name(list, select);
+}
+
+static void watch_pump(FileList *list) {
+    watch_read_events(list);
+    // Changes seen mid-load wait until the listing is complete.
+    if (list->loader || list->sorter || watch_timeout_ms(list) != 0) return;
+    if (list->watch_reload) reload_keep_cursor(list);
+    else apply_name_changes(list, &list->watch_pending);
+    listing_reset(&list->watch_pending);
+    list->watch_due.tv_sec = 0;
+    list->watch_reload = 0;
+}
+
+// Sleep until a key arrives, the watched directory changes or background
+// work is due. stdscr is in nodelay mode, so handle_input() never blocks.
+static void wait_for_event(FileList *list) {
+    int ch = getch();    // ncurses may already hold buffered keys
+    if (ch != ERR) { ungetch(ch); return; }
+    struct pollfd fds[2];
+    int nfds = 0;
+    fds[nfds].fd = STDIN_FILENO;
+    fds[nfds++].events = POLLIN;
+    if (list->watch_fd >= 0) {
+        fds[nfds].fd = list->watch_fd;
+        fds[nfds++].events = POLLIN;
+    }
+    int timeout_ms = (list->loader || list->sorter || list->du) ? BACKGROUND_TICK_MS : -1;
+    int due = watch_timeout_ms(list);
+    if (due >= 0 && (timeout_ms < 0 || due < timeout_ms)) timeout_ms = due;
+    due = prefetch_timeout_ms(list);
+    if (due >= 0 && (timeout_ms < 0 || due < timeout_ms)) timeout_ms = due;
+    due = preview_timeout_ms(list);
+    if (due >= 0 && (timeout_ms < 0 || due < timeout_ms)) timeout_ms = due;
+    poll(fds, (nfds_t)nfds, timeout_ms);
+}
+
+static const char* sort_label(SortMode m) {
+    switch (m) {
+        case SORT_NAME: return "name";
+        case SORT_SIZE: return "size";
+        case SORT_TIME: return "time";
+        case SORT_EXT:  return "ext";
+        case SORT_DU:   return "du";
+        default: return "name";
+    }
+}
+
+static void filter_label(const FileList *list, char *out, size_t out_len) {
+    switch (list->filter_mode) {
+        case FILTER_ALL:   snprintf(out, out_len, "all"); break;
+        case FILTER_FILES: snprintf(out, out_len, "files"); break;
+        case FILTER_DIRS:  snprintf(out, out_len, "dirs"); break;
+        case FILTER_CONTAINS:
+            if (list->filter_text[0] == '\0') snprintf(out, out_len, "contains:*");
+            else snprintf(out, out_len, "contains:%s", list->filter_text);
+            break;
+        default: snprintf(out, out_len, "all"); break;
+    }
+}
+
+void draw_status_bar(FileList *list) {
+    int max_y, max_x;
+    getmaxyx(stdscr, max_y, max_x);
+    attron(COLOR_PAIR(4));
+    mvhline(max_y - 2, 0, ACS_HLINE, max_x);
+    attroff(COLOR_PAIR(4));
+    move(max_y - 1, 0);
+    clrtoeol();
+    attron(COLOR_PAIR(8) | A_BOLD);
+    mvprintw(max_y - 1, 1, "NBL GoTo | mode: %s |", list->filter_typing ? "FILTER" : "NORMAL");
+    mvprintw(max_y - 1, 25, " dir:  %s", list->cwd);
+    char filt[300];
+    filter_label(list, filt, sizeof(filt));
+    char loading[48] = "";
+    if (list->loader) snprintf(loading, sizeof(loading), "loading %d\u2026  ", list->entries.count);
+    else if (list->sorter) snprintf(loading, sizeof(loading), "sorting\u2026  ");
+    else if (list->du) snprintf(loading, sizeof(loading), "du %d/%d\u2026  ", list->du->taken, list->du->ntops);
+    char status[256];
+    snprintf(status, sizeof(status),
+             "%sHidden:%s%s  Sort:%s%s  Filter:%s  %d/%d ",
+             loading,
+             list->show_hidden ? "ON" : "OFF",
+             list->show_ignored ? "  Ignored:ON" : "",
+             sort_label(list->sort_mode),
+             list->sort_reverse ? " (rev)" : "",
+             filt,
+             (list->count > 0 ? list->selected + 1 : 0),
+             list->count);
+    mvprintw(max_y - 1, max_x - (int)strlen(status) - 1, "%s", status);
+    attroff(COLOR_PAIR(8) | A_BOLD);
+}
+
+// Rows are only rewritten when what they show changed, so moving the
+// cursor touches two rows and the status line. A scroll shifts the rows
+// still on screen with the terminal's scroll region (idlok is on) and
+// draws only the ones scrolled in. The whole screen is repainted on a
+// resize, in a new directory, or when list->repaint says something else
+// drew over it.
+void draw_ui(FileList *list) {
+    int max_y, max_x;
+    getmaxyx(stdscr, max_y, max_x);
+    int visible_lines = max_y - 3;
+    if (visible_lines < 0) visible_lines = 0;
+    // with the preview pane open, rows only get the left half
+    int pane = list->preview_on && max_x >= PREVIEW_MIN_COLS;
+    int cols = pane ? max_x - max_x / 2 : max_x;
+    ScreenShadow *sh = &list->shown;
+    if (list->repaint || !sh->row || sh->rows != visible_lines || sh->cols != cols ||
+        sh->dev != list->dir_dev || sh->ino != list->dir_ino) {
+        if (!sh->row || sh->rows != visible_lines) {
+            uint64_t *row = realloc(sh->row, (size_t)(visible_lines + 1) * sizeof(*row));
+            if (!row) return;
+            sh->row = row;
+        }
+        memset(sh->row, 0, (size_t)visible_lines * sizeof(*sh->row));
+        sh->rows = visible_lines;
+        sh->cols = cols;
+        sh->pane = 0;
+        sh->dev = list->dir_dev;
+        sh->ino = list->dir_ino;
+        list->repaint = 0;
+        clear();
+    } else if (sh->scroll_offset != list->scroll_offset) {
+        int delta = list->scroll_offset - sh->scroll_offset;
+        int keep = visible_lines - abs(delta);
+        // scrolling would drag the pane along; let curses diff the rows instead
+        if (pane) keep = 0;
+        if (keep > 0) {
+            setscrreg(0, visible_lines - 1);
+            scrollok(stdscr, TRUE);
+            scrl(delta);
+            scrollok(stdscr, FALSE);
+            setscrreg(0, max_y - 1);
+            if (delta > 0) {
+                memmove(sh->row, sh->row + delta, (size_t)keep * sizeof(*sh->row));
+                memset(sh->row + keep, 0, (size_t)delta * sizeof(*sh->row));
+            } else {
+                memmove(sh->row - delta, sh->row, (size_t)keep * sizeof(*sh->row));
+                memset(sh->row, 0, (size_t)-delta * sizeof(*sh->row));
+            }
+        }
+    }
+    sh->scroll_offset = list->scroll_offset;
+    stat_visible_rows(list, list->scroll_offset, visible_lines);
+    DirListing *d = &list->entries;
+    for (int i = 0; i < visible_lines; i++) {
+        int idx = i + list->scroll_offset;
+        const RowStyle *rs = NULL;
+        const char *name = "";
+        attr_t attr = 0;
+        uint64_t h = 1;     // blank row
+        if (idx < list->count) {
+            uint32_t e = row_entry(list, idx);
+            rs = row_style(d, e);
+            name = entry_name(d, e);
+            attr = idx == list->selected ? (attr_t)(A_REVERSE | A_BOLD) : g_paint[rs->paint];
+            h = hash_bytes(name, strlen(name)) ^ hash_bytes((const char *)rs, sizeof(*rs)) * 31 ^ (uint64_t)attr;
+            if (h <= 1) h = 2;
+        }
+        if (sh->row[i] == h) continue;
+        sh->row[i] = h;
+        move(i, 0);
+        if (pane) hline(' ', cols);
+        else clrtoeol();
+        if (!rs) continue;
+        char line[MAX_PATH];
+        snprintf(line, sizeof(line), "%s  %-*s", g_icons[rs->icon], cols - 20, name);
+        attron(attr);
+        // clipped, so a long name never wraps onto the next row
+        mvaddnstr(i, 1, line, cols > 2 ? cols - 2 : 0);
+        if (rs->size[0]) mvprintw(i, cols - 12, "%10s", rs->size);
+        attroff(attr);
+    }
+    if (pane) draw_preview(list, cols, max_x - cols, visible_lines);
+    draw_status_bar(list);
+    refresh();
+    clock_gettime(CLOCK_MONOTONIC, &list->drawn);
+}
+
+// ---- path lists -------------------------------------------------------
+
+// Relative paths below a root, stored back to back. The buffer keeps
+// SCAN_SLACK spare bytes so vector loads may run past the last path.
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    uint32_t *off;
+    uint16_t *plen;
+    unsigned char *is_dir;
+    int count;
+    int capacity;
+} PathList;
+
+
+static int pathlist_append(PathList *p, const char *dir, size_t dlen, const char *name, size_t nlen, int is_dir) {
+    size_t len = dlen ? dlen + 1 + nlen : nlen;
+    if (len > UINT16_MAX) return -1;
+    if (p->count == p->capacity) {
+        int cap = p->capacity ? p->capacity * 2 : 1024;
+        uint32_t *off = realloc(p->off, (size_t)cap * sizeof(*off));
+        if (!off) return -1;
+        p->off = off;
+        uint16_t *plen = realloc(p->plen, (size_t)cap * sizeof(*plen));
+        if (!plen) return -1;
+        p->plen = plen;
+        unsigned char *d = realloc(p->is_dir, (size_t)cap);
+        if (!d) return -1;
+        p->is_dir = d;
+        p->capacity = cap;
+    }
+    if (p->len + len + 1 + SCAN_SLACK > p->cap) {
+        size_t cap = p->cap ? p->cap : 64 * 1024;
+        while (cap < p->len + len + 1 + SCAN_SLACK) cap *= 2;
+        if (cap > UINT32_MAX) { errno = ENOMEM; return -1; }
+        char *buf = realloc(p->buf, cap);
+        if (!buf) return -1;
+        p->buf = buf;
+        p->cap = cap;
+    }
+    char *at = p->buf + p->len;
+    if (dlen) {
+        memcpy(at, dir, dlen);
+        at[dlen] = '/';
+        memcpy(at + dlen + 1, name, nlen);
+    } else {
+        memcpy(at, name, nlen);
+    }
+    at[len] = '\0';
+    memset(at + len + 1, 0, SCAN_SLACK);
+    p->off[p->count] = (uint32_t)p->len;
+    p->plen[p->count] = (uint16_t)len;
+    p->is_dir[p->count] = (unsigned char)is_dir;
+    p->count++;
+    p->len += len + 1;
+    return 0;
+}
+
+static void pathlist_free(PathList *p) {
+    free(p->buf);
+    free(p->off);
+    free(p->plen);
+    free(p->is_dir);
+    memset(p, 0, sizeof(*p));
+}
+
+// Copy src into an empty dst, slack included.
+static int pathlist_copy(PathList *dst, const PathList *src) {
+    size_t n = (size_t)src->count;
+    dst->buf = malloc(src->len + SCAN_SLACK);
+    dst->off = malloc(n * sizeof(*dst->off) + 1);
+    dst->plen = malloc(n * sizeof(*dst->plen) + 1);
+    dst->is_dir = malloc(n + 1);
+    if (!dst->buf || !dst->off || !dst->plen || !dst->is_dir) {
+        pathlist_free(dst);
+        return -1;
+    }
+    memcpy(dst->buf, src->buf, src->len);
+    memset(dst->buf + src->len, 0, SCAN_SLACK);
+    memcpy(dst->off, src->off, n * sizeof(*dst->off));
+    memcpy(dst->plen, src->plen, n * sizeof(*dst->plen));
+    memcpy(dst->is_dir, src->is_dir, n);
+    dst->len = src->len;
+    dst->cap = src->len + SCAN_SLACK;
+    dst->count = dst->capacity = src->count;
+    return 0;
+}
+
+static inline const char *path_at(const PathList *p, int i) {
+    return p->buf + p->off[i];
+}
+
+// Modification time of a directory as it was when its entries were read,
+// the ignore rules they were filtered with, and where those entries sit
+// in the path list. Stamps that are too recent to trust (the directory
+// may change again within the same timestamp) are stored as zero and
+// never match.
+typedef struct {
+    int64_t mtime_ns;
+    uint64_t rules;           // IgnoreChain hash, 0 when nothing was pruned
+    uint32_t first;
+    uint32_t count;
+} DirStamp;
+
+// A walked tree: every path, plus each directory that was read with its
+// stamp. The entries of one directory are always contiguous in paths.
+typedef struct {
+    PathList paths;
+    PathList dirs;            // parallel to stamp[]
+    DirStamp *stamp;
+    int stamp_cap;
+} PathTree;
+
+static int pathtree_add_dir(PathTree *t, const char *path, size_t len, const DirStamp *st) {
+    if (t->dirs.count == t->stamp_cap) {
+        int cap = t->stamp_cap ? t->stamp_cap * 2 : 256;
+        DirStamp *s = realloc(t->stamp, (size_t)cap * sizeof(*s));
+        if (!s) return -1;
+        t->stamp = s;
+        t->stamp_cap = cap;
+    }
+    if (pathlist_append(&t->dirs, NULL, 0, path, len, 1) != 0) return -1;
+    t->stamp[t->dirs.count - 1] = *st;
+    return 0;
+}
+
+static void pathtree_free(PathTree *t) {
+    pathlist_free(&t->paths);
+    pathlist_free(&t->dirs);
+    free(t->stamp);
+    memset(t, 0, sizeof(*t));
+}
+
+// ---- path index -------------------------------------------------------
+
+// A PathTree saved under $XDG_CACHE_HOME/goto, one file per root, so a
+// later search starts from the last walk and only re-reads directories
+// whose mtime moved. Every array is stored as it sits in memory, padded
+// to 8 bytes, so a mapped index is used in place:
+//
+//   IndexHeader, root path,
+//   DirStamp[ndirs], dir off[], dir len[], dir is_dir[], dir strings,
+//   path off[], path len[], path is_dir[], path strings
+#define INDEX_MAGIC "GOTOIDX"
+#define INDEX_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t root_len;
+    uint32_t ndirs;
+    uint32_t npaths;
+    uint64_t dirs_bytes;
+    uint64_t paths_bytes;
+} IndexHeader;
+
+typedef struct {
+    void *map;
+    size_t size;
+    const DirStamp *stamp;
+    PathList dirs;            // points into map, never freed
+    PathList paths;           // points into map, never freed
+    uint32_t *slot;           // dir path hash -> dir index, UINT32_MAX if empty
+    uint32_t mask;
+} PathIndex;
+
+static uint64_t hash_bytes(const char *s, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Index file for root: $XDG_CACHE_HOME/goto/<hash>.idx (or ~/.cache),
+// creating the directories on the way. A walk that keeps ignored paths
+// has its own index, <hash>.all.idx.
+static int index_file_path(const char *root, int prune, char *out, size_t out_len) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[MAX_PATH];
+    int ret;
+    if (xdg && xdg[0] == '/') {
+        ret = snprintf(dir, sizeof(dir), "%s", xdg);
+    } else if (home && *home) {
+        ret = snprintf(dir, sizeof(dir), "%s/.cache", home);
+    } else {
+        errno = ENOENT;
+        return -1;
+    }
+    if (ret < 0 || ret >= (int)sizeof(dir) - 6) { errno = ENAMETOOLONG; return -1; }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) return -1;
+    strcat(dir, "/goto");
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) return -1;
+    ret = snprintf(out, out_len, "%s/%016llx%s.idx", dir,
+                   (unsigned long long)hash_bytes(root, strlen(root)), prune ? "" : ".all");
+    if (ret < 0 || ret >= (int)out_len) { errno = ENAMETOOLONG; return -1; }
+    return 0;
+}
+
+static size_t pad8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+// Point p at a mapped path list of n entries starting at *at, checking
+// that it fits in the file and that every path lies inside the strings.
+static int index_map_paths(const char *base, size_t size, size_t *at, uint32_t n, uint64_t bytes, PathList *p) {
+    // bound the header's counts first, so the padding below cannot wrap
+    if (*at > size || n > size || bytes > size - *at) return -1;
+    size_t need = pad8((size_t)n * 4) + pad8((size_t)n * 2) + pad8(n) + pad8((size_t)bytes);
+    if (need > size - *at) return -1;
+    p->off = (uint32_t *)(base + *at);
+    *at += pad8((size_t)n * 4);
+    p->plen = (uint16_t *)(base + *at);
+    *at += pad8((size_t)n * 2);
+    p->is_dir = (unsigned char *)(base + *at);
+    *at += pad8(n);
+    p->buf = (char *)(base + *at);
+    *at += pad8(bytes);
+    p->len = p->cap = bytes;
+    p->count = p->capacity = (int)n;
+    for (uint32_t i = 0; i < n; i++) {
+        if ((uint64_t)p->off[i] + p->plen[i] >= bytes || p->buf[p->off[i] + p->plen[i]] != '\0') return -1;
+    }
+    return 0;
+}
+
+static void index_close(PathIndex *x) {
+    if (!x) return;
+    if (x->map) munmap(x->map, x->size);
+    free(x->slot);
+    free(x);
+}
+
+// Map the index saved for root, or NULL if there is none or it does not
+// check out (a bad index is rebuilt, never trusted).
+static PathIndex *index_open(const char *file, const char *root) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    PathIndex *x = calloc(1, sizeof(*x));
+    if (!x || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) goto fail;
+    x->size = (size_t)st.st_size;
+    x->map = mmap(NULL, x->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (x->map == MAP_FAILED) { x->map = NULL; goto fail; }
+    close(fd);
+    fd = -1;
+
+    const char *base = x->map;
+    const IndexHeader *h = x->map;
+    size_t root_len = strlen(root);
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0 || h->version != INDEX_VERSION ||
+        h->root_len != root_len || h->ndirs > INT_MAX || h->npaths > INT_MAX) goto fail;
+    size_t at = sizeof(*h);
+    if (pad8(root_len) > x->size - at || memcmp(base + at, root, root_len) != 0) goto fail;
+    at += pad8(root_len);
+    if ((size_t)h->ndirs * sizeof(DirStamp) > x->size - at) goto fail;
+    x->stamp = (const DirStamp *)(base + at);
+    at += (size_t)h->ndirs * sizeof(DirStamp);
+    if (index_map_paths(base, x->size, &at, h->ndirs, h->dirs_bytes, &x->dirs) != 0 ||
+        index_map_paths(base, x->size, &at, h->npaths, h->paths_bytes, &x->paths) != 0) goto fail;
+    for (uint32_t i = 0; i < h->ndirs; i++) {
+        if ((uint64_t)x->stamp[i].first + x->stamp[i].count > h->npaths) goto fail;
+    }
+
+    uint32_t cap = 16;
+    while (cap < 2 * h->ndirs) cap *= 2;
+    x->slot = malloc((size_t)cap * sizeof(*x->slot));
+    if (!x->slot) goto fail;
+    memset(x->slot, 0xff, (size_t)cap * sizeof(*x->slot));
+    x->mask = cap - 1;
+    for (uint32_t i = 0; i < h->ndirs; i++) {
+        uint32_t s = (uint32_t)hash_bytes(path_at(&x->dirs, (int)i), x->dirs.plen[i]) & x->mask;
+        while (x->slot[s] != UINT32_MAX) s = (s + 1) & x->mask;
+        x->slot[s] = i;
+    }
+    return x;
+fail:
+    if (fd >= 0) close(fd);
+    index_close(x);
+    return NULL;
+}
+
+static int index_find_dir(const PathIndex *x, const char *path, size_t len) {
+    uint32_t s = (uint32_t)hash_bytes(path, len) & x->mask;
+    for (; x->slot[s] != UINT32_MAX; s = (s + 1) & x->mask) {
+        uint32_t i = x->slot[s];
+        if (x->dirs.plen[i] == len && memcmp(path_at(&x->dirs, (int)i), path, len) == 0) return (int)i;
+    }
+    return -1;
+}
+
+static int write_padded(FILE *f, const void *p, size_t n) {
+    static const char zero[8];
+    if (n && fwrite(p, 1, n, f) != n) return -1;
+    size_t pad = pad8(n) - n;
+    return pad && fwrite(zero, 1, pad, f) != pad ? -1 : 0;
+}
+
+static int write_paths(FILE *f, const PathList *p) {
+    size_t n = (size_t)p->count;
+    if (write_padded(f, p->off, n * 4) || write_padded(f, p->plen, n * 2) ||
+        write_padded(f, p->is_dir, n) || write_padded(f, p->buf, p->len)) return -1;
+    return 0;
+}
+
+// Save t as the index for root: written beside the old one and renamed
+// over it, so a reader never maps a half-written file.
+static int index_save(const char *file, const char *root, const PathTree *t) {
+    char tmp[MAX_PATH];
+    int ret = snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid());
+    if (ret < 0 || ret >= (int)sizeof(tmp)) { errno = ENAMETOOLONG; return -1; }
+    FILE *f = fopen(tmp, "wbe");
+    if (!f) return -1;
+    IndexHeader h = {0};
+    memcpy(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    h.version = INDEX_VERSION;
+    h.root_len = (uint32_t)strlen(root);
+    h.ndirs = (uint32_t)t->dirs.count;
+    h.npaths = (uint32_t)t->paths.count;
+    h.dirs_bytes = t->dirs.len;
+    h.paths_bytes = t->paths.len;
+    int bad = fwrite(&h, sizeof(h), 1, f) != 1 || write_padded(f, root, h.root_len) ||
+              write_padded(f, t->stamp, (size_t)h.ndirs * sizeof(DirStamp)) ||
+              write_paths(f, &t->dirs) || write_paths(f, &t->paths);
+    if (fclose(f) != 0) bad = 1;
+    if (bad || rename(tmp, file) != 0) {
+        int saved = errno;
+        unlink(tmp);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+// ---- ignore rules -----------------------------------------------------
+
+// .gitignore semantics for tree walks: a directory's .gitignore and
+// .ignore (and .git/info/exclude next to a .git) apply to everything
+// below it, deeper files win over shallower ones, the last matching line
+// of a file wins, and a pruned directory is never entered, so nothing
+// under it can be re-included. Compiled files are cached by inode and
+// mtime, so later searches reuse them without reparsing.
+#define IGNORE_FILE_MAX (1024 * 1024)   // larger ignore files are not read
+#define IGNORE_CACHE_SLOTS 1024
+#define IGNORE_CACHE_MAX 4096           // compiled files kept across walks
+
+enum {
+    IGN_NEGATE = 1,     // "!pattern": re-include
+    IGN_DIR = 2,        // "pattern/": directories only
+    IGN_PATH = 4,       // has a slash: matched against the path below the file's directory
+    IGN_LITERAL = 8,    // no glob characters: plain compare
+    IGN_SUFFIX = 16     // "*literal": compare the end of the name
+};
+
+typedef struct {
+    uint32_t off;       // into strings
+    uint16_t len;
+    uint8_t flags;
+} IgnoreRule;
+
+typedef struct IgnoreFile {
+    struct IgnoreFile *next;    // cache slot chain, guarded by g_ignore_lock
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime_ns;
+    off_t size;
+    atomic_int refs;
+    int count;
+    IgnoreRule *rule;
+    char *strings;
+} IgnoreFile;
+
+// The rules in force in one directory: its own files, then its parent's.
+// Directories without ignore files share their parent's chain.
+typedef struct IgnoreChain {
+    struct IgnoreChain *parent;
+    atomic_int refs;
+    IgnoreFile *file[3];        // info/exclude, .gitignore, .ignore: later ones win
+    uint32_t base_len;          // the directory's path below the walk root
+    uint64_t hash;              // identifies every file up the chain
+    char prefix[];              // above the root: the root's path below this directory
+} IgnoreChain;
+
+// Never descended into, whatever the ignore files say.
+static const char *const g_ignore_builtin[] = {
+    ".git", ".hg", ".svn", ".bzr", "_darcs", "CVS", "node_modules", "__pycache__",
+};
+
+static pthread_mutex_t g_ignore_lock = PTHREAD_MUTEX_INITIALIZER;
+static IgnoreFile *g_ignore_cache[IGNORE_CACHE_SLOTS];
+static int g_ignore_cached;
+
+static void ignore_file_unref(IgnoreFile *f) {
+    if (!f || atomic_fetch_sub(&f->refs, 1) != 1) return;
+    free(f->rule);
+    free(f->strings);
+    free(f);
+}
+
+static void ignore_unref(IgnoreChain *c) {
+    while (c && atomic_fetch_sub(&c->refs, 1) == 1) {
+        IgnoreChain *parent = c->parent;
+        for (int i = 0; i < 3; i++) ignore_file_unref(c->file[i]);
+        free(c);
+        c = parent;
+    }
+}
+
+static IgnoreChain *ignore_ref(IgnoreChain *c) {
+    if (c) atomic_fetch_add(&c->refs, 1);
+    return c;
+}
+
+static int has_glob(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\') return 1;
+    return 0;
+}
+
+// Parse one line of an ignore file into rule r (pattern copied to *at).
+// Returns 0 for a rule, -1 for a blank line or a comment.
+static int ignore_parse_line(char *line, size_t len, IgnoreRule *r, char *strings, size_t *at) {
+    if (len && line[len - 1] == '\r') len--;
+    while (len && line[len - 1] == ' ' && !(len > 1 && line[len - 2] == '\\')) len--;
+    if (len == 0 || line[0] == '#') return -1;
+    uint8_t flags = 0;
+    if (line[0] == '!') { flags |= IGN_NEGATE; line++; len--; }
+    else if (line[0] == '\\' && len > 1 && (line[1] == '#' || line[1] == '!')) { line++; len--; }
+    if (len && line[len - 1] == '/') { flags |= IGN_DIR; len--; }
+    // "**/name" is the same as "name"
+    while (len > 3 && memcmp(line, "**/", 3) == 0 && !memchr(line + 3, '/', len - 3)) { line += 3; len -= 3; }
+    if (memchr(line, '/', len)) {
+        flags |= IGN_PATH;
+        if (line[0] == '/') { line++; len--; }
+    }
+    if (len == 0 || len > UINT16_MAX) return -1;
+    if (!(flags & IGN_PATH)) {
+        if (!has_glob(line, len)) flags |= IGN_LITERAL;
+        else if (line[0] == '*' && !has_glob(line + 1, len - 1)) flags |= IGN_SUFFIX;
+    }
+    memcpy(strings + *at, line, len);
+    strings[*at + len] = '\0';
+    r->off = (uint32_t)*at;
+    r->len = (uint16_t)len;
+    r->flags = flags;
+    *at += len + 1;
+    return 0;
+}
+
+static IgnoreFile *ignore_compile(int fd, const struct stat *st) {
+    size_t size = (size_t)st->st_size;
+    IgnoreFile *f = calloc(1, sizeof(*f));
+    char *text = malloc(size + 1);
+    if (!f || !text) goto fail;
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, text + got, size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    text[got] = '\n';
+    int lines = 1;
+    for (size_t i = 0; i < got; i++) lines += text[i] == '\n';
+    f->rule = malloc((size_t)lines * sizeof(*f->rule));
+    f->strings = malloc(got + 1);
+    if (!f->rule || !f->strings) goto fail;
+    size_t at = 0;
+    for (char *line = text, *end = text + got; line <= end; ) {
+        char *nl = memchr(line, '\n', (size_t)(end - line) + 1);
+        if (ignore_parse_line(line, (size_t)(nl - line), &f->rule[f->count], f->strings, &at) == 0) f->count++;
+        line = nl + 1;
+    }
+    free(text);
+    f->dev = st->st_dev;
+    f->ino = st->st_ino;
+    f->mtime_ns = stat_mtime_ns(st);
+    f->size = st->st_size;
+    atomic_init(&f->refs, 1);
+    return f;
+fail:
+    free(text);
+    if (f) { free(f->rule); free(f->strings); free(f); }
+    return NULL;
+}
+
+// The compiled ignore file at path (relative to at_fd), from the cache
+// when it has not changed. NULL if there is none.
+static IgnoreFile *ignore_file_get(int at_fd, const char *path) {
+    int fd = openat(at_fd, path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > IGNORE_FILE_MAX) {
+        close(fd);
+        return NULL;
+    }
+    uint32_t slot = (uint32_t)(((uint64_t)st.st_dev * 31 + (uint64_t)st.st_ino) % IGNORE_CACHE_SLOTS);
+    pthread_mutex_lock(&g_ignore_lock);
+    for (IgnoreFile *f = g_ignore_cache[slot]; f; f = f->next) {
+        if (f->dev == st.st_dev && f->ino == st.st_ino &&
+            f->mtime_ns == stat_mtime_ns(&st) && f->size == st.st_size) {
+            atomic_fetch_add(&f->refs, 1);
+            pthread_mutex_unlock(&g_ignore_lock);
+            close(fd);
+            return f;
+        }
+    }
+    pthread_mutex_unlock(&g_ignore_lock);
+
+    IgnoreFile *f = ignore_compile(fd, &st);
+    close(fd);
+    if (!f) return NULL;
+    pthread_mutex_lock(&g_ignore_lock);
+    if (g_ignore_cached >= IGNORE_CACHE_MAX) {
+        for (int i = 0; i < IGNORE_CACHE_SLOTS; i++) {
+            while (g_ignore_cache[i]) {
+                IgnoreFile *next = g_ignore_cache[i]->next;
+                ignore_file_unref(g_ignore_cache[i]);
+                g_ignore_cache[i] = next;
+            }
+        }
+        g_ignore_cached = 0;
+    }
+    // an older version of the same file is dropped from the cache
+    for (IgnoreFile **p = &g_ignore_cache[slot]; *p; p = &(*p)->next) {
+        if ((*p)->dev == f->dev && (*p)->ino == f->ino) {
+            IgnoreFile *old = *p;
+            *p = old->next;
+            ignore_file_unref(old);
+            g_ignore_cached--;
+            break;
+        }
+    }
+    f->next = g_ignore_cache[slot];
+    g_ignore_cache[slot] = f;
+    g_ignore_cached++;
+    atomic_fetch_add(&f->refs, 1);
+    pthread_mutex_unlock(&g_ignore_lock);
+    return f;
+}
+
+// Ignore files present among a directory's entries.
+enum { HAS_EXCLUDE = 1, HAS_GITIGNORE = 2, HAS_IGNORE = 4 };
+
+static int ignore_file_bit(const char *name) {
+    if (name[0] != '.') return 0;
+    if (strcmp(name, ".gitignore") == 0) return HAS_GITIGNORE;
+    if (strcmp(name, ".ignore") == 0) return HAS_IGNORE;
+    if (strcmp(name, ".git") == 0) return HAS_EXCLUDE;
+    return 0;
+}
+
+// The chain in force inside dir (dlen bytes, relative to at_fd or
+// absolute) given the chain of its parent and which ignore files it has.
+// prefix is non-empty only for directories above the walk root.
+static IgnoreChain *ignore_enter(int at_fd, IgnoreChain *parent, const char *dir, size_t dlen,
+                                 int has, uint32_t base_len, const char *prefix) {
+    static const char *const names[3] = { ".git/info/exclude", ".gitignore", ".ignore" };
+    IgnoreFile *file[3] = {0};
+    int any = 0;
+    for (int i = 0; i < 3; i++) {
+        if (!(has & (1 << i))) continue;
+        char path[MAX_PATH];
+        int ret = dlen ? snprintf(path, sizeof(path), "%.*s/%s", (int)dlen, dir, names[i])
+                       : snprintf(path, sizeof(path), "%s", names[i]);
+        if (ret < 0 || ret >= (int)sizeof(path)) continue;
+        file[i] = ignore_file_get(at_fd, path);
+        any |= file[i] != NULL;
+    }
+    if (!any) return ignore_ref(parent);
+    size_t plen = strlen(prefix);
+    IgnoreChain *c = calloc(1, sizeof(*c) + plen + 1);
+    if (!c) {
+        for (int i = 0; i < 3; i++) ignore_file_unref(file[i]);
+        return ignore_ref(parent);
+    }
+    c->parent = ignore_ref(parent);
+    atomic_init(&c->refs, 1);
+    c->base_len = base_len;
+    memcpy(c->prefix, prefix, plen + 1);
+    uint64_t h = parent ? parent->hash : 1469598103934665603ULL;
+    for (int i = 0; i < 3; i++) {
+        c->file[i] = file[i];
+        uint64_t id[4] = { 0, 0, 0, (uint64_t)i };
+        if (file[i]) {
+            id[0] = (uint64_t)file[i]->ino;
+            id[1] = (uint64_t)file[i]->mtime_ns;
+            id[2] = (uint64_t)file[i]->size;
+        }
+        h = (h ^ hash_bytes((const char *)id, sizeof(id))) * 1099511628211ULL;
+    }
+    c->hash = h;
+    return c;
+}
+
+// Match a gitignore glob: `*` and `?` stay within one path component,
+// `**` crosses them, `[...]` classes, backslash escapes.
+static int ignore_glob(const char *p, const char *pe, const char *s, const char *se) {
+    while (p < pe) {
+        char c = *p;
+        if (c == '*') {
+            if (p + 1 < pe && p[1] == '*') {
+                p += 2;
+                if (p == pe) return 1;
+                int dirs = (*p == '/');     // "**/": zero or more whole directories
+                p += dirs;
+                for (const char *t = s; ; t++) {
+                    if ((!dirs || t == s || t[-1] == '/') && ignore_glob(p, pe, t, se)) return 1;
+                    if (t == se) return 0;
+                }
+            }
+            p++;
+            for (const char *t = s; ; t++) {
+                if (ignore_glob(p, pe, t, se)) return 1;
+                if (t == se || *t == '/') return 0;
+            }
+        }
+        if (s == se) return 0;
+        if (c == '?') {
+            if (*s == '/') return 0;
+        } else if (c == '[') {
+            const char *q = p + 1;
+            int neg = 0, hit = 0;
+            if (q < pe && (*q == '!' || *q == '^')) { neg = 1; q++; }
+            const char *first = q;
+            for (; q < pe && (*q != ']' || q == first); q++) {
+                unsigned char lo = (unsigned char)*q, hi = lo;
+                if (q + 2 < pe && q[1] == '-' && q[2] != ']') { hi = (unsigned char)q[2]; q += 2; }
+                if ((unsigned char)*s >= lo && (unsigned char)*s <= hi) hit = 1;
+            }
+            if (q == pe) {                  // no closing bracket: a literal '['
+                if (*s != '[') return 0;
+            } else {
+                if (hit == neg || *s == '/') return 0;
+                p = q;
+            }
+        } else {
+            if (c == '\\' && p + 1 < pe) c = *++p;
+            if (c != *s) return 0;
+        }
+        p++;
+        s++;
+    }
+    return s == se;
+}
+
+static int ignore_rule_match(const IgnoreFile *f, const IgnoreRule *r, const char *s, size_t len) {
+    const char *pat = f->strings + r->off;
+    if (r->flags & IGN_LITERAL) return len == r->len && memcmp(s, pat, len) == 0;
+    if (r->flags & IGN_SUFFIX)
+        return len >= (size_t)r->len - 1 && memcmp(s + len - (r->len - 1), pat + 1, r->len - 1) == 0;
+    return ignore_glob(pat, pat + r->len, s, s + len);
+}
+
+// Whether name in dir (relative to the walk root) is pruned under chain c.
+static int ignore_match(const IgnoreChain *c, const char *dir, size_t dlen,
+                        const char *name, size_t nlen, int is_dir) {
+    for (size_t i = 0; i < sizeof(g_ignore_builtin) / sizeof(g_ignore_builtin[0]); i++)
+        if (strcmp(name, g_ignore_builtin[i]) == 0) return 1;
+    char rel[MAX_PATH];
+    for (; c; c = c->parent) {
+        size_t rlen = SIZE_MAX;     // rel is built on the first path rule
+        for (int k = 2; k >= 0; k--) {
+            const IgnoreFile *f = c->file[k];
+            if (!f) continue;
+            for (int i = f->count - 1; i >= 0; i--) {
+                const IgnoreRule *r = &f->rule[i];
+                if ((r->flags & IGN_DIR) && !is_dir) continue;
+                int hit;
+                if (r->flags & IGN_PATH) {
+                    if (rlen == SIZE_MAX) {
+                        const char *d = dir + c->base_len;
+                        size_t n = dlen - c->base_len;
+                        if (n && *d == '/') { d++; n--; }
+                        int ret = snprintf(rel, sizeof(rel), "%s%s%.*s%s%.*s",
+                                           c->prefix, c->prefix[0] && n ? "/" : "",
+                                           (int)n, d, (c->prefix[0] || n) ? "/" : "", (int)nlen, name);
+                        if (ret < 0 || ret >= (int)sizeof(rel)) ret = 0;
+                        rlen = (size_t)ret;
+                    }
+                    hit = rlen && ignore_rule_match(f, r, rel, rlen);
+                } else {
+                    hit = ignore_rule_match(f, r, name, nlen);
+                }
+                if (hit) return !(r->flags & IGN_NEGATE);
+            }
+        }
+    }
+    return 0;
+}
+
+// Rules from the directories above root, up to the enclosing repository
+// (the nearest one with a .git). NULL outside a repository.
+static IgnoreChain *ignore_above(const char *root) {
+    size_t len = strlen(root);
+    if (len == 0 || root[0] != '/' || len >= MAX_PATH) return NULL;
+    char path[MAX_PATH];
+    struct stat st;
+    size_t top = len;
+    for (;;) {
+        int ret = snprintf(path, sizeof(path), "%.*s/.git", (int)top, root);
+        if (ret > 0 && ret < (int)sizeof(path) && fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) == 0) break;
+        while (top > 0 && root[top - 1] != '/') top--;
+        if (top <= 1) return NULL;
+        top--;
+    }
+    if (top == len) return NULL;    // root is the top of its repository
+    IgnoreChain *c = NULL;
+    for (size_t at = top; at < len; ) {
+        size_t dlen = at ? at : 1;
+        int has = HAS_GITIGNORE | HAS_IGNORE | (at == top ? HAS_EXCLUDE : 0);
+        IgnoreChain *next = ignore_enter(AT_FDCWD, c, root, dlen, has, 0, root + at + 1);
+        ignore_unref(c);
+        c = next;
+        at++;
+        while (at < len && root[at] != '/') at++;
+    }
+    return c;
+}
+
+// ---- tree walk --------------------------------------------------------
+
+// Walks a whole tree on a pool of threads that share one stack of
+// directories (no depth limit, symlinks not followed) and hands the paths
+// over in batches through a locked queue, like the directory loader.
+// Given a previous index, a directory whose mtime has not moved is not
+// read again: its entries are taken from the index. With prune set,
+// ignored paths are left out and ignored directories are not entered.
+typedef struct WalkDir {
+    struct WalkDir *next;
+    IgnoreChain *rules;       // in force in the parent, or NULL
+    char path[];
+} WalkDir;
+
+typedef struct WalkBatch {
+    struct WalkBatch *next;
+    PathTree tree;
+} WalkBatch;
+
+#define WALK_BATCH_PATHS 4096
+
+typedef struct {
+    int root_fd;
+    const PathIndex *prev;
+    int prune;
+    time_t started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    WalkDir *stack;           // guarded by lock
+    int busy;                 // guarded by lock
+    WalkBatch *head, *tail;   // guarded by lock
+    int done;                 // guarded by lock
+    atomic_int cancel;
+    atomic_int reread;        // directories actually read, not taken from prev
+    int nthreads;
+    pthread_t threads[STAT_WORKERS_MAX];
+} TreeWalk;
+
+static void walk_publish(TreeWalk *w, WalkBatch **cur) {
+    WalkBatch *b = *cur;
+    if (!b || b->tree.paths.count == 0) return;
+    *cur = NULL;
+    if (w->tail) w->tail->next = b;
+    else w->head = b;
+    w->tail = b;
+}
+
+static WalkDir *walk_dir_new(const char *dir, size_t dlen, const char *name, size_t nlen) {
+    size_t len = dlen ? dlen + 1 + nlen : nlen;
+    WalkDir *d = malloc(sizeof(*d) + len + 1);
+    if (!d) return NULL;
+    d->next = NULL;
+    d->rules = NULL;
+    if (dlen) {
+        memcpy(d->path, dir, dlen);
+        d->path[dlen] = '/';
+        memcpy(d->path + dlen + 1, name, nlen);
+    } else {
+        memcpy(d->path, name, nlen);
+    }
+    d->path[len] = '\0';
+    return d;
+}
+
+static void walk_dir_free(WalkDir *d) {
+    ignore_unref(d->rules);
+    free(d);
+}
+
+static void walk_push(WalkDir **subs, const char *path, size_t len, IgnoreChain *rules) {
+    WalkDir *sub = walk_dir_new(NULL, 0, path, len);
+    if (!sub) return;
+    sub->rules = ignore_ref(rules);
+    sub->next = *subs;
+    *subs = sub;
+}
+
+// Take the entries of dir from the previous index if its mtime still
+// matches. Returns 0 if they were taken, -1 if it has to be read.
+static int walk_reuse(TreeWalk *w, const WalkDir *dir, size_t dlen, const struct stat *st, PathTree *t, WalkDir **subs) {
+    int k = index_find_dir(w->prev, dir->path, dlen);
+    if (k < 0) return -1;
+    DirStamp s = w->prev->stamp[k];
+    if (s.mtime_ns == 0 || s.mtime_ns != stat_mtime_ns(st)) return -1;
+    const PathList *p = &w->prev->paths;
+    IgnoreChain *rules = NULL;
+    if (w->prune) {
+        // the entries are unchanged, so they say which ignore files there are
+        int has = 0;
+        for (uint32_t i = s.first; i < s.first + s.count; i++)
+            has |= ignore_file_bit(path_at(p, (int)i) + (dlen ? dlen + 1 : 0));
+        rules = ignore_enter(w->root_fd, dir->rules, dir->path, dlen, has, (uint32_t)dlen, "");
+    }
+    if ((rules ? rules->hash : 0) != s.rules) {
+        ignore_unref(rules);
+        return -1;
+    }
+    uint32_t first = s.first;
+    s.first = (uint32_t)t->paths.count;
+    for (uint32_t i = first; i < first + s.count; i++) {
+        pathlist_append(&t->paths, NULL, 0, path_at(p, (int)i), p->plen[i], p->is_dir[i]);
+        if (p->is_dir[i]) walk_push(subs, path_at(p, (int)i), p->plen[i], rules);
+    }
+    pathtree_add_dir(t, dir->path, dlen, &s);
+    ignore_unref(rules);
+    return 0;
+}
+
+// Read one directory: its entries go to *cur, its subdirectories to *subs.
+static void walk_visit(TreeWalk *w, const WalkDir *dir, DirListing *names, WalkBatch **cur, WalkDir **subs) {
+    if (!*cur) *cur = calloc(1, sizeof(**cur));
+    if (!*cur) return;
+    PathTree *t = &(*cur)->tree;
+    size_t dlen = strlen(dir->path);
+    const char *at = dir->path[0] ? dir->path : ".";
+    struct stat st;
+    if (w->prev) {
+        if (fstatat(w->root_fd, at, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(st.st_mode)) return;
+        if (walk_reuse(w, dir, dlen, &st, t, subs) == 0) return;
+    }
+    int fd = openat(w->root_fd, at, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return;
+    if (!w->prev && fstat(fd, &st) != 0) { close(fd); return; }
+    atomic_fetch_add_explicit(&w->reread, 1, memory_order_relaxed);
+    listing_reset(names);
+    DirReader reader;
+    if (dir_reader_open(&reader, fd) == 0) {
+        while (dir_reader_next(&reader, names, GETDENTS_BUF_SIZE) > 0 &&
+               !atomic_load_explicit(&w->cancel, memory_order_relaxed)) {}
+        dir_reader_close(&reader);
+    }
+    IgnoreChain *rules = NULL;
+    if (w->prune) {
+        int has = 0;
+        for (int i = 0; i < names->count; i++) has |= ignore_file_bit(entry_name(names, (uint32_t)i));
+        rules = ignore_enter(w->root_fd, dir->rules, dir->path, dlen, has, (uint32_t)dlen, "");
+    }
+    DirStamp s = { stat_mtime_ns(&st), rules ? rules->hash : 0, (uint32_t)t->paths.count, 0 };
+    if (st.st_mtime >= w->started - 1) s.mtime_ns = 0;
+    for (int i = 0; i < names->count; i++) {
+        const char *name = entry_name(names, (uint32_t)i);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        int is_dir = names->is_dir[i];
+        if (!(names->meta[i] & META_TYPE)) {
+            struct stat est;
+            is_dir = fstatat(fd, name, &est, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(est.st_mode);
+        }
+        size_t nlen = strlen(name);
+        if (w->prune && ignore_match(rules, dir->path, dlen, name, nlen, is_dir)) continue;
+        if (pathlist_append(&t->paths, dir->path, dlen, name, nlen, is_dir) != 0) continue;
+        if (is_dir) walk_push(subs, path_at(&t->paths, t->paths.count - 1), t->paths.plen[t->paths.count - 1], rules);
+    }
+    close(fd);
+    ignore_unref(rules);
+    s.count = (uint32_t)t->paths.count - s.first;
+    pathtree_add_dir(t, dir->path, dlen, &s);
+}
+
+static void *walk_worker(void *arg) {
+    TreeWalk *w = arg;
+    DirListing names = {0};
+    WalkBatch *cur = NULL;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        if (!w->stack) walk_publish(w, &cur);
+        while (!w->stack && w->busy > 0 && !atomic_load(&w->cancel))
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (atomic_load(&w->cancel) || !w->stack) break;
+        WalkDir *dir = w->stack;
+        w->stack = dir->next;
+        w->busy++;
+        pthread_mutex_unlock(&w->lock);
+        WalkDir *subs = NULL;
+        walk_visit(w, dir, &names, &cur, &subs);
+        walk_dir_free(dir);
+        pthread_mutex_lock(&w->lock);
+        int pushed = (subs != NULL);
+        while (subs) {
+            WalkDir *next = subs->next;
+            subs->next = w->stack;
+            w->stack = subs;
+            subs = next;
+        }
+        if (cur && cur->tree.paths.count >= WALK_BATCH_PATHS) walk_publish(w, &cur);
+        w->busy--;
+        if (pushed || w->busy == 0) pthread_cond_broadcast(&w->cond);
+    }
+    walk_publish(w, &cur);
+    if (w->busy == 0 && !w->stack) w->done = 1;
+    pthread_mutex_unlock(&w->lock);
+    if (cur) { pathtree_free(&cur->tree); free(cur); }
+    listing_free(&names);
+    return NULL;
+}
+
+// Walk the tree under dir_fd (the directory root); prev (which must
+// outlive the walk) is the last index of the same tree, or NULL to read
+// every directory. prune leaves out what ignore files exclude.
+static TreeWalk *walk_start(int dir_fd, const char *root, const PathIndex *prev, int prune) {
+    TreeWalk *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->root_fd = dup(dir_fd);
+    w->stack = walk_dir_new("", 0, "", 0);
+    if (w->root_fd < 0 || !w->stack) {
+        if (w->root_fd >= 0) close(w->root_fd);
+        free(w->stack);
+        free(w);
+        return NULL;
+    }
+    w->prev = prev;
+    w->prune = prune;
+    if (prune) w->stack->rules = ignore_above(root);
+    w->started = time(NULL);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    atomic_init(&w->cancel, 0);
+    atomic_init(&w->reread, 0);
+    int workers = stat_worker_count();
+    pthread_mutex_lock(&w->lock);
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&w->threads[w->nthreads], NULL, walk_worker, w) != 0) break;
+        w->nthreads++;
+    }
+    if (w->nthreads == 0) { walk_dir_free(w->stack); w->stack = NULL; w->done = 1; }
+    pthread_mutex_unlock(&w->lock);
+    return w;
+}
+
+// Append everything walked so far to out. Returns 1 once the walk is over
+// and everything has been handed out.
+static int walk_take(TreeWalk *w, PathTree *out) {
+    pthread_mutex_lock(&w->lock);
+    WalkBatch *b = w->head;
+    w->head = w->tail = NULL;
+    int done = w->done;
+    pthread_mutex_unlock(&w->lock);
+    while (b) {
+        WalkBatch *next = b->next;
+        const PathTree *t = &b->tree;
+        uint32_t base = (uint32_t)out->paths.count;
+        for (int i = 0; i < t->paths.count; i++)
+            pathlist_append(&out->paths, NULL, 0, path_at(&t->paths, i), t->paths.plen[i], t->paths.is_dir[i]);
+        for (int i = 0; i < t->dirs.count; i++) {
+            DirStamp s = t->stamp[i];
+            s.first += base;
+            pathtree_add_dir(out, path_at(&t->dirs, i), t->dirs.plen[i], &s);
+        }
+        pathtree_free(&b->tree);
+        free(b);
+        b = next;
+    }
+    return done;
+}
+
+static void walk_free(TreeWalk *w) {
+    if (!w) return;
+    pthread_mutex_lock(&w->lock);
+    atomic_store(&w->cancel, 1);
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    for (int i = 0; i < w->nthreads; i++) pthread_join(w->threads[i], NULL);
+    PathTree drop = {0};
+    walk_take(w, &drop);
+    pathtree_free(&drop);
+    while (w->stack) {
+        WalkDir *next = w->stack->next;
+        walk_dir_free(w->stack);
+        w->stack = next;
+    }
+    close(w->root_fd);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(w);
+}
+
+// ---- fuzzy finder -----------------------------------------------------
+
+#define FUZZY_TOP_MAX 512          // best matches kept sorted for display
+#define FUZZY_PARALLEL_MIN 16384   // candidates worth scoring on several threads
+#define FUZZY_CHUNK 4096
+
+// Index of the first byte at or after `from` that equals c (ASCII case
+// folded; c is lowercase), or -1. Paths carry SCAN_SLACK readable bytes
+// past their end, so the vector loop never reads outside the buffer.
+static int find_ci(const char *s, int len, int from, unsigned char c) {
+    unsigned char up = (unsigned char)toupper(c);
+#if defined(__SSE2__)
+    const __m128i lo_v = _mm_set1_epi8((char)c), up_v = _mm_set1_epi8((char)up);
+    for (int i = from; i < len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lo_v), _mm_cmpeq_epi8(v, up_v)));
+        if (mask) {
+            int at = i + __builtin_ctz(mask);
+            return at < len ? at : -1;
+        }
+    }
+    return -1;
+#else
+    for (int i = from; i < len; i++) {
+        unsigned char x = (unsigned char)s[i];
+        if (x == c || x == up) return i;
+    }
+    return -1;
+#endif
+}
+
+static int is_boundary(const char *s, int i) {
+    if (i == 0) return 1;
+    char p = s[i - 1];
+    if (p == '/' || p == '_' || p == '-' || p == '.' || p == ' ') return 1;
+    return islower((unsigned char)p) && isupper((unsigned char)s[i]);
+}
+
+// Score s against the lowercase query q; 0 means no match. The vector
+// search confirms q is a subsequence and finds where the first match
+// ends, a backward pass then tightens its start, and only that window
+// is scored: matches at word starts and runs of consecutive characters
+// earn bonuses, gaps cost a little, and hits in the file name beat hits
+// in its directories. Matched positions go to pos[] when it is non-NULL.
+static int fuzzy_score(const char *s, int len, const char *q, int qlen, int *pos) {
+    if (qlen == 0) return 1;
+    int at = -1;
+    for (int j = 0; j < qlen; j++) {
+        at = find_ci(s, len, at + 1, (unsigned char)q[j]);
+        if (at < 0) return 0;
+    }
+    int end = at + 1, start = 0;
+    for (int i = at, j = qlen - 1; i >= 0; i--) {
+        if (tolower((unsigned char)s[i]) == (unsigned char)q[j] && --j < 0) { start = i; break; }
+    }
+    const char *slash = memrchr(s, '/', (size_t)len);
+    int base = slash ? (int)(slash - s) + 1 : 0;
+    int score = 0, j = 0, prev = -2, run = 0, gap = 0;
+    for (int i = start; i < end && j < qlen; i++) {
+        if (tolower((unsigned char)s[i]) != (unsigned char)q[j]) {
+            if (j > 0) score -= gap++ ? 1 : 3;
+            continue;
+        }
+        int bonus = 16;
+        if (is_boundary(s, i)) bonus += 10;
+        if (prev == i - 1) bonus += 6 + 2 * run++;
+        else run = 0;
+        if (i >= base) bonus += 4;
+        score += bonus;
+        if (pos) pos[j] = i;
+        prev = i;
+        gap = 0;
+        j++;
+    }
+    score -= len / 8;
+    return score > 1 ? score : 1;
+}
+
+// A match set saved when the query grew, so backspace can go back to it.
+typedef struct {
+    uint32_t *match;
+    int *score;
+    int nmatch;
+    int match_cap;
+    int scored;
+    int qlen;
+} FuzzyLevel;
+
+typedef struct {
+    PathTree tree;            // candidates
+    PathTree fresh;           // refresh of an indexed tree, swapped in when done
+    PathIndex *index;         // last walk of this root, NULL if none
+    char index_file[MAX_PATH];
+    TreeWalk *walk;
+    int walk_done;
+    char query[256];
+    int qlen;
+    char matched[256];        // query the match set below was built for
+    uint32_t *match;          // candidates matching `matched`, among [0, scored)
+    int *score;
+    int nmatch;
+    int match_cap;
+    int scored;
+    FuzzyLevel levels[256];   // match sets for shorter prefixes of `matched`
+    int nlevels;
+    uint32_t top[FUZZY_TOP_MAX];  // best matches, best first
+    int ntop;
+    int selected;
+} Finder;
+
+typedef struct {
+    const Finder *f;
+    const uint32_t *in;       // candidate ids, or NULL for [base, base + n)
+    int base;
+    uint32_t *out;
+    int *out_score;
+    int *kept;                // matches per FUZZY_CHUNK
+} FuzzyPass;
+
+static void fuzzy_range(void *ctx, int begin, int end) {
+    FuzzyPass *fp = ctx;
+    const Finder *f = fp->f;
+    int k = begin;
+    for (int i = begin; i < end; i++) {
+        uint32_t c = fp->in ? fp->in[i] : (uint32_t)(fp->base + i);
+        int s = fuzzy_score(path_at(&f->tree.paths, (int)c), f->tree.paths.plen[c], f->query, f->qlen, NULL);
+        if (s > 0) {
+            fp->out[k] = c;
+            fp->out_score[k] = s;
+            k++;
+        }
+    }
+    fp->kept[begin / FUZZY_CHUNK] = k - begin;
+}
+
+// Score n candidates (ids from in[], or base..base+n) and append the
+// matches to f->match, on several threads when there are many.
+static void fuzzy_score_into(Finder *f, const uint32_t *in, int base, int n) {
+    if (n <= 0) return;
+    uint32_t *out = malloc((size_t)n * sizeof(*out));
+    int *out_score = malloc((size_t)n * sizeof(*out_score));
+    int chunks = (n + FUZZY_CHUNK - 1) / FUZZY_CHUNK;
+    int *kept = calloc((size_t)chunks, sizeof(*kept));
+    if (!out || !out_score || !kept) goto out;
+    FuzzyPass fp = { .f = f, .in = in, .base = base, .out = out, .out_score = out_score, .kept = kept };
+    int workers = sort_worker_count();
+    if (n < FUZZY_PARALLEL_MIN || workers <= 1) {
+        for (int c = 0; c < chunks; c++) {
+            int e = (c + 1) * FUZZY_CHUNK;
+            fuzzy_range(&fp, c * FUZZY_CHUNK, e < n ? e : n);
+        }
+    } else {
+        parallel_for(n, FUZZY_CHUNK, workers, fuzzy_range, &fp);
+    }
+    int total = f->nmatch;
+    for (int c = 0; c < chunks; c++) total += kept[c];
+    if (total > f->match_cap) {
+        uint32_t *m = realloc(f->match, (size_t)total * sizeof(*m));
+        if (!m) goto out;
+        f->match = m;
+        int *s = realloc(f->score, (size_t)total * sizeof(*s));
+        if (!s) goto out;
+        f->score = s;
+        f->match_cap = total;
+    }
+    for (int c = 0; c < chunks; c++) {
+        memcpy(f->match + f->nmatch, out + c * FUZZY_CHUNK, (size_t)kept[c] * sizeof(*out));
+        memcpy(f->score + f->nmatch, out_score + c * FUZZY_CHUNK, (size_t)kept[c] * sizeof(*out_score));
+        f->nmatch += kept[c];
+    }
+out:
+    free(out);
+    free(out_score);
+    free(kept);
+}
+
+// Better match first: higher score, then shorter path, then walk order.
+static int fuzzy_better(const Finder *f, uint32_t a, int sa, uint32_t b, int sb) {
+    if (sa != sb) return sa > sb;
+    if (f->tree.paths.plen[a] != f->tree.paths.plen[b]) return f->tree.paths.plen[a] < f->tree.paths.plen[b];
+    return a < b;
+}
+
+// Keep the FUZZY_TOP_MAX best matches, best first: a bounded min-heap
+// over the match set, then a sort of just those.
+static void fuzzy_rank(Finder *f) {
+    uint32_t heap[FUZZY_TOP_MAX];
+    int hs[FUZZY_TOP_MAX];
+    int n = 0;
+    for (int m = 0; m < f->nmatch; m++) {
+        uint32_t c = f->match[m];
+        int s = f->score[m];
+        int i;
+        if (n < FUZZY_TOP_MAX) {
+            i = n++;
+            while (i > 0 && fuzzy_better(f, heap[(i - 1) / 2], hs[(i - 1) / 2], c, s)) {
+                heap[i] = heap[(i - 1) / 2];
+                hs[i] = hs[(i - 1) / 2];
+                i = (i - 1) / 2;
+            }
+        } else {
+            if (!fuzzy_better(f, c, s, heap[0], hs[0])) continue;
+            i = 0;
+            for (;;) {
+                int l = 2 * i + 1, r = l + 1, w = i;
+                uint32_t wc = c;
+                int ws = s;
+                if (l < n && fuzzy_better(f, wc, ws, heap[l], hs[l])) { w = l; wc = heap[l]; ws = hs[l]; }
+                if (r < n && fuzzy_better(f, wc, ws, heap[r], hs[r])) w = r;
+                if (w == i) break;
+                heap[i] = heap[w];
+                hs[i] = hs[w];
+                i = w;
+            }
+        }
+        heap[i] = c;
+        hs[i] = s;
+    }
+    // Popping the min-heap yields worst first; fill top[] from the back.
+    f->ntop = n;
+    while (n > 0) {
+        f->top[n - 1] = heap[0];
+        n--;
+        uint32_t c = heap[n];
+        int s = hs[n], i = 0;
+        for (;;) {
+            int l = 2 * i + 1, r = l + 1, w = i;
+            uint32_t wc = c;
+            int ws = s;
+            if (l < n && fuzzy_better(f, wc, ws, heap[l], hs[l])) { w = l; wc = heap[l]; ws = hs[l]; }
+            if (r < n && fuzzy_better(f, wc, ws, heap[r], hs[r])) w = r;
+            if (w == i) break;
+            heap[i] = heap[w];
+            hs[i] = hs[w];
+            i = w;
+        }
+        heap[i] = c;
+        hs[i] = s;
+    }
+    if (f->selected >= f->ntop) f->selected = f->ntop > 0 ? f->ntop - 1 : 0;
+}
+
+static void fuzzy_drop_levels(Finder *f, int keep) {
+    while (f->nlevels > keep) {
+        FuzzyLevel *l = &f->levels[--f->nlevels];
+        free(l->match);
+        free(l->score);
+    }
+}
+
+// Bring the match set up to date with the query and the candidates
+// walked so far. A query that only grew narrows the previous matches
+// instead of rescoring everything, and keeps them on a stack so that
+// backspace gets them back without scoring at all.
+static void fuzzy_update(Finder *f) {
+    size_t mlen = strlen(f->matched);
+    if (strcmp(f->query, f->matched) != 0) {
+        if ((size_t)f->qlen > mlen && strncmp(f->query, f->matched, mlen) == 0) {
+            FuzzyLevel *l = &f->levels[f->nlevels++];
+            *l = (FuzzyLevel){ f->match, f->score, f->nmatch, f->match_cap, f->scored, (int)mlen };
+            f->match = NULL;
+            f->score = NULL;
+            f->nmatch = f->match_cap = 0;
+            fuzzy_score_into(f, l->match, 0, l->nmatch);
+        } else {
+            free(f->match);
+            free(f->score);
+            f->match = NULL;
+            f->score = NULL;
+            f->nmatch = f->match_cap = f->scored = 0;
+            // Matches for shorter queries stay valid only while the query
+            // is still a prefix of the one they were narrowed towards.
+            int keep = 0;
+            while (keep < f->nlevels && f->levels[keep].qlen <= f->qlen &&
+                   strncmp(f->query, f->matched, (size_t)f->levels[keep].qlen) == 0) keep++;
+            fuzzy_drop_levels(f, keep);
+            if (f->nlevels > 0 && f->levels[f->nlevels - 1].qlen == f->qlen) {
+                FuzzyLevel *l = &f->levels[--f->nlevels];
+                f->match = l->match;
+                f->score = l->score;
+                f->nmatch = l->nmatch;
+                f->match_cap = l->match_cap;
+                f->scored = l->scored;
+            }
+        }
+        memcpy(f->matched, f->query, sizeof(f->matched));
+        f->selected = 0;
+    }
+    if (f->scored < f->tree.paths.count) {
+        fuzzy_score_into(f, NULL, f->scored, f->tree.paths.count - f->scored);
+        f->scored = f->tree.paths.count;
+    }
+    fuzzy_rank(f);
+}
+
+// The walk is over. A refresh that re-read any directory replaces the
+// candidates from the index; either way the tree is saved for next time.
+static void fuzzy_walk_done(Finder *f, const char *root) {
+    if (f->index) {
+        if (atomic_load(&f->walk->reread) == 0) {
+            pathtree_free(&f->fresh);
+            return;
+        }
+        pathtree_free(&f->tree);
+        f->tree = f->fresh;
+        memset(&f->fresh, 0, sizeof(f->fresh));
+        free(f->match);
+        free(f->score);
+        f->match = NULL;
+        f->score = NULL;
+        f->nmatch = f->match_cap = f->scored = 0;
+        fuzzy_drop_levels(f, 0);
+    }
+    if (f->index_file[0]) index_save(f->index_file, root, &f->tree);
+}
+
+static void fuzzy_draw(const Finder *f) {
+    int max_y, max_x;
+    getmaxyx(stdscr, max_y, max_x);
+    erase();
+    int rows = max_y - 2;
+    int first = f->selected >= rows ? f->selected - rows + 1 : 0;
+    int pos[256];
+    for (int r = 0; r < rows && first + r < f->ntop; r++) {
+        int idx = first + r;
+        uint32_t c = f->top[idx];
+        const char *s = path_at(&f->tree.paths, (int)c);
+        int len = f->tree.paths.plen[c];
+        fuzzy_score(s, len, f->query, f->qlen, pos);
+        int sel = (idx == f->selected);
+        if (sel) attron(A_REVERSE | A_BOLD);
+        else if (f->tree.paths.is_dir[c]) attron(COLOR_PAIR(1));
+        mvhline(r, 0, ' ', max_x);
+        mvprintw(r, 1, "%.*s%s", max_x - 3, s, f->tree.paths.is_dir[c] ? "/" : "");
+        if (!sel) attron(A_BOLD | A_UNDERLINE);
+        for (int j = 0; j < f->qlen; j++) {
+            if (pos[j] < max_x - 3) mvaddch(r, 1 + pos[j], (unsigned char)s[pos[j]]);
+        }
+        attroff(A_BOLD | A_UNDERLINE | A_REVERSE | COLOR_PAIR(1));
+    }
+    attron(COLOR_PAIR(4));
+    mvhline(max_y - 2, 0, ACS_HLINE, max_x);
+    attroff(COLOR_PAIR(4));
+    char status[64];
+    snprintf(status, sizeof(status), " %d/%d%s ", f->nmatch, f->tree.paths.count, f->walk_done ? "" : " …");
+    attron(COLOR_PAIR(8) | A_BOLD);
+    mvprintw(max_y - 1, max_x - (int)strlen(status) - 1, "%s", status);
+    mvprintw(max_y - 1, 1, "> %s", f->query);
+    attroff(COLOR_PAIR(8) | A_BOLD);
+    move(max_y - 1, 3 + f->qlen);
+    refresh();
+}
+
+// Built-in `/`: walk the tree under cwd on background threads and fuzzy
+// match the paths as they stream in. With an index from an earlier walk
+// the search starts on its paths at once, while a refresh re-reads only
+// the directories that changed. Writes the chosen path (relative to cwd)
+// to out; returns 1 if one was chosen, 0 if cancelled.
+static int fuzzy_select_path(FileList *list, char *out, size_t out_len) {
+    Finder *f = calloc(1, sizeof(*f));
+    if (!f) return -1;
+    int prune = !list->show_ignored;
+    if (index_file_path(list->cwd, prune, f->index_file, sizeof(f->index_file)) != 0)
+        f->index_file[0] = '\0';
+    else if ((f->index = index_open(f->index_file, list->cwd)) != NULL)
+        pathlist_copy(&f->tree.paths, &f->index->paths);
+    f->walk = walk_start(list->dir_fd, list->cwd, f->index, prune);
+    if (!f->walk) {
+        index_close(f->index);
+        pathtree_free(&f->tree);
+        free(f);
+        return -1;
+    }
+    int chosen = 0, dirty = 1;
+    curs_set(1);
+    for (;;) {
+        if (!f->walk_done) {
+            int before = f->tree.paths.count;
+            f->walk_done = walk_take(f->walk, f->index ? &f->fresh : &f->tree);
+            if (f->walk_done) fuzzy_walk_done(f, list->cwd);
+            if (f->tree.paths.count != before || f->walk_done) dirty = 1;
+        }
+        if (dirty) {
+            fuzzy_update(f);
+            fuzzy_draw(f);
+            dirty = 0;
+        }
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        int ch = getch();
+        if (ch == ERR) {
+            poll(&pfd, 1, f->walk_done ? -1 : BACKGROUND_TICK_MS);
+            continue;
+        }
+        dirty = 1;
+        if (ch == 27 || ch == 3) break;                   // ESC, Ctrl-C
+        if (ch == '\n' || ch == KEY_ENTER) {
+            if (f->ntop > 0) {
+                snprintf(out, out_len, "%s", path_at(&f->tree.paths, (int)f->top[f->selected]));
+                chosen = 1;
+            }
+            break;
+        }
+        if (ch == KEY_UP || ch == 16 || ch == 11) {         // Ctrl-P, Ctrl-K
+            if (f->selected > 0) f->selected--;
+        } else if (ch == KEY_DOWN || ch == 14 || ch == 9) {         // Ctrl-N, Tab
+            if (f->selected + 1 < f->ntop) f->selected++;
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if (f->qlen > 0) f->query[--f->qlen] = '\0';
+        } else if (ch == 21) {                              // Ctrl-U
+            f->qlen = 0;
+            f->query[0] = '\0';
+        } else if (ch >= 32 && ch < 127 && f->qlen + 1 < (int)sizeof(f->query)) {
+            f->query[f->qlen++] = (char)tolower(ch);
+            f->query[f->qlen] = '\0';
+        }
+    }
+    curs_set(0);
+    walk_free(f->walk);
+    index_close(f->index);
+    pathtree_free(&f->tree);
+    pathtree_free(&f->fresh);
+    free(f->match);
+    free(f->score);
+    fuzzy_drop_levels(f, 0);
+    free(f);
+    clear();
+    return chosen;
+}
+
+// ---- in-file search ---------------------------------------------------
+
+#define LINE_BLOCK (64 * 1024)      // bytes per entry of the line-number index
+#define SEARCH_CHUNK (1024 * 1024)  // bytes scanned between clock checks
+#define SEARCH_TICK_MS 8            // scanning per input poll
+#define SEARCH_MATCH_MAX 100000     // scanning pauses once this many lines match
+
+// `?`: the selected file, read through pread a window at a time. It is
+// never mapped: a file truncated under a mapping (a log rotated with
+// copytruncate, say) raises SIGBUS, while a read just comes up short.
+// Matches are kept as line start offsets; line numbers are worked out only
+// for the rows on screen, from a per-block count of newlines that grows
+// as the scan passes each block (so opening the file reads nothing up
+// front).
+typedef struct {
+    int fd;
+    size_t size;              // at open; less is there if the file shrank
+    char *buf;                // scan window, SEARCH_CHUNK + SCAN_SLACK bytes
+    char *blk;                // one LINE_BLOCK, for counting newlines
+    uint64_t *block_lines;    // newlines before each LINE_BLOCK-byte block
+    size_t nblocks;
+    size_t indexed;           // block_lines[0..indexed] are known
+    char query[256];
+    int qlen;
+    int use_regex;
+    regex_t re;
+    int re_state;             // 1 compiled, 0 none, -1 query does not compile
+    char matched[256];        // query match[] and scan_pos are for
+    int matched_regex;
+    uint64_t *match;          // line start offsets, ascending
+    size_t nmatch;
+    size_t match_cap;
+    size_t scan_pos;          // lines before this were tested
+    int selected;
+} FileSearch;
+
+static size_t count_newlines(const char *s, size_t n) {
+    size_t count = 0, i = 0;
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        count += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+    }
+#endif
+    for (; i < n; i++) count += (s[i] == '\n');
+    return count;
+}
+
+// Newlines in the n bytes of the file at off (fewer if it shrank).
+static size_t search_count_at(FileSearch *fs, size_t off, size_t n) {
+    ssize_t got = pread(fs->fd, fs->blk, n, (off_t)off);
+    return got > 0 ? count_newlines(fs->blk, (size_t)got) : 0;
+}
+
+// Make block_lines[b] known.
+static void search_index_to(FileSearch *fs, size_t b) {
+    if (b >= fs->nblocks) b = fs->nblocks - 1;
+    for (; fs->indexed < b; fs->indexed++) {
+        size_t at = fs->indexed * LINE_BLOCK;
+        size_t n = at >= fs->size ? 0 : fs->size - at < LINE_BLOCK ? fs->size - at : LINE_BLOCK;
+        fs->block_lines[fs->indexed + 1] = fs->block_lines[fs->indexed] + (n ? search_count_at(fs, at, n) : 0);
+    }
+}
+
+static uint64_t search_line_no(FileSearch *fs, size_t off) {
+    size_t b = off / LINE_BLOCK;
+    search_index_to(fs, b);
+    return fs->block_lines[b] + search_count_at(fs, b * LINE_BLOCK, off - b * LINE_BLOCK) + 1;
+}
+
+static int search_push(FileSearch *fs, size_t line_start) {
+    if (fs->nmatch == fs->match_cap) {
+        size_t cap = fs->match_cap ? fs->match_cap * 2 : 1024;
+        uint64_t *m = realloc(fs->match, cap * sizeof(*m));
+        if (!m) return -1;
+        fs->match = m;
+        fs->match_cap = cap;
+    }
+    fs->match[fs->nmatch++] = line_start;
+    return 0;
+}
+
+static int regex_line(const regex_t *re, const char *s, size_t len) {
+#ifdef REG_STARTEND
+    regmatch_t m = { .rm_so = 0, .rm_eo = (regoff_t)len };
+    return regexec(re, s, 1, &m, REG_STARTEND) == 0;
+#else
+    char *copy = strndup(s, len);
+    int hit = copy && regexec(re, copy, 0, NULL, 0) == 0;
+    free(copy);
+    return hit;
+#endif
+}
+
+// What a line must contain: a substring (ASCII case ignored) or, when re
+// is set, a match of it. An empty needle without re matches every line.
+typedef struct {
+    const char *needle;
+    size_t nlen;
+    const regex_t *re;
+} LineQuery;
+
+// Called with the bounds of each matching line; nonzero stops the scan.
+typedef int (*line_fn)(void *ctx, size_t start, size_t end);
+
+// Report the lines of hay[0, n) that match q, as offsets plus base. hay
+// needs SCAN_SLACK readable bytes after n. The substring search runs
+// over the whole range, so lines without a match cost nothing beyond the
+// vector scan. Returns 1 if fn stopped it.
+static int match_lines(const char *hay, size_t n, size_t base, const LineQuery *q, line_fn fn, void *ctx) {
+    size_t pos = 0;
+    while (pos < n) {
+        size_t start = pos, end;
+        if (q->re || q->nlen == 0) {
+            const char *nl = memchr(hay + pos, '\n', n - pos);
+            end = nl ? (size_t)(nl - hay) : n;
+            if (q->re && !regex_line(q->re, hay + start, end - start)) { pos = end + 1; continue; }
+        } else {
+            ptrdiff_t hit = find_substr_ci(hay + pos, n - pos, q->needle, q->nlen);
+            if (hit < 0) break;
+            size_t at = pos + (size_t)hit;
+            const char *nl = memrchr(hay + pos, '\n', at - pos);
+            start = nl ? (size_t)(nl - hay) + 1 : pos;
+            nl = memchr(hay + at, '\n', n - at);
+            end = nl ? (size_t)(nl - hay) : n;
+        }
+        if (fn(ctx, base + start, base + end)) return 1;
+        pos = end + 1;
+    }
+    return 0;
+}
+
+// Read up to max bytes of fd at off into buf, which has SCAN_SLACK spare
+// bytes, for match_lines(). A full window is cut back to its last newline
+// unless a single line fills it; *more is then set. Returns the bytes
+// kept, 0 at the end of the file or on error.
+static size_t read_window(int fd, char *buf, size_t max, off_t off, int *more) {
+    ssize_t n = pread(fd, buf, max, off);
+    *more = 0;
+    if (n <= 0) return 0;
+    size_t len = (size_t)n;
+    if (len == max) {
+        *more = 1;
+        const char *nl = memrchr(buf, '\n', len);
+        if (nl) len = (size_t)(nl - buf) + 1;
+    }
+    memset(buf + len, 0, SCAN_SLACK);
+    return len;
+}
+
+static int search_hit(void *ctx, size_t start, size_t end) {
+    (void)end;
+    return search_push(ctx, start) != 0;
+}
+
+static LineQuery search_query(const FileSearch *fs) {
+    LineQuery q = { fs->query, (size_t)fs->qlen, NULL };
+    if (fs->use_regex && fs->re_state > 0) q.re = &fs->re;
+    return q;
+}
+
+// Scan on from scan_pos for about SEARCH_TICK_MS. Returns 1 while there
+// is more to scan.
+static int search_pump(FileSearch *fs) {
+    if (fs->re_state < 0) return 0;
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    while (fs->scan_pos < fs->size && fs->nmatch < SEARCH_MATCH_MAX) {
+        int more;
+        size_t len = read_window(fs->fd, fs->buf, SEARCH_CHUNK, (off_t)fs->scan_pos, &more);
+        if (len == 0) { fs->size = fs->scan_pos; break; }   // the file shrank
+        LineQuery q = search_query(fs);
+        match_lines(fs->buf, len, fs->scan_pos, &q, search_hit, fs);
+        fs->scan_pos += len;
+        if (!more && fs->scan_pos < fs->size) fs->size = fs->scan_pos;
+        search_index_to(fs, fs->scan_pos / LINE_BLOCK);   // while the pages are warm
+        if (elapsed_ms(&started) >= SEARCH_TICK_MS) break;
+    }
+    return fs->scan_pos < fs->size && fs->nmatch < SEARCH_MATCH_MAX;
+}
+
+// Keep the matches whose line still contains the (substring) query. The
+// lines are ascending, so one window read from the first untested match
+// serves every match that ends inside it. A line longer than a window
+// is judged by the part that fits.
+static void search_narrow(FileSearch *fs) {
+    size_t w = 0, i = 0;
+    while (i < fs->nmatch) {
+        size_t a = fs->match[i];
+        int more;
+        size_t len = read_window(fs->fd, fs->buf, SEARCH_CHUNK, (off_t)a, &more);
+        if (len == 0) break;   // the rest of the file is gone
+        size_t j = i;
+        while (j < fs->nmatch && fs->match[j] - a < len) {
+            size_t at = fs->match[j] - a;
+            const char *nl = memchr(fs->buf + at, '\n', len - at);
+            size_t end = nl ? (size_t)(nl - fs->buf) : len;
+            if (!nl && more && j > i) break;   // read it again from its start
+            if (contains_ci(fs->buf + at, end - at, fs->query, (size_t)fs->qlen)) fs->match[w++] = fs->match[j];
+            j++;
+        }
+        i = j;
+    }
+    fs->nmatch = w;
+}
+
+// Bring the match set in line with the query. A substring query that only
+// grew re-tests the lines that matched before and resumes the scan where
+// it stopped; anything else starts the scan over.
+static void search_update(FileSearch *fs) {
+    if (fs->use_regex == fs->matched_regex && strcmp(fs->query, fs->matched) == 0) return;
+    size_t mlen = strlen(fs->matched);
+    int narrow = !fs->use_regex && !fs->matched_regex && (size_t)fs->qlen > mlen &&
+                 strncasecmp(fs->query, fs->matched, mlen) == 0;
+    if (fs->re_state > 0) regfree(&fs->re);
+    fs->re_state = 0;
+    if (fs->use_regex && fs->qlen > 0)
+        fs->re_state = regcomp(&fs->re, fs->query, REG_EXTENDED | REG_ICASE | REG_NOSUB) == 0 ? 1 : -1;
+    if (narrow) {
+        search_narrow(fs);
+    } else {
+        fs->nmatch = 0;
+        fs->scan_pos = 0;
+    }
+    memcpy(fs->matched, fs->query, sizeof(fs->matched));
+    fs->matched_regex = fs->use_regex;
+    fs->selected = 0;
+}
+
+static void search_draw(FileSearch *fs, const char *name, int scanning) {
+    int max_y, max_x;
+    getmaxyx(stdscr, max_y, max_x);
+    erase();
+    int rows = max_y - 2;
+    int first = fs->selected >= rows ? fs->selected - rows + 1 : 0;
+    int width = max_x - 10;
+    if (width < 1) width = 1;
+    for (int r = 0; r < rows && (size_t)(first + r) < fs->nmatch; r++) {
+        int idx = first + r;
+        size_t start = fs->match[idx];
+        char text[1024 + SCAN_SLACK];
+        ssize_t got = pread(fs->fd, text, (size_t)width < 1024 ? (size_t)width : 1024, (off_t)start);
+        size_t len = got > 0 ? (size_t)got : 0;
+        const char *nl = memchr(text, '\n', len);
+        if (nl) len = (size_t)(nl - text);
+        for (size_t i = 0; i < len; i++) {
+            unsigned char c = (unsigned char)text[i];
+            text[i] = (c < 32 || c == 127) ? ' ' : (char)c;
+        }
+        memset(text + len, 0, SCAN_SLACK);
+        int sel = (idx == fs->selected);
+        if (sel) attron(A_REVERSE | A_BOLD);
+        mvhline(r, 0, ' ', max_x);
+        attron(COLOR_PAIR(6));
+        mvprintw(r, 0, "%7llu", (unsigned long long)search_line_no(fs, start));
+        attroff(COLOR_PAIR(6));
+        mvaddnstr(r, 9, text, (int)len);
+        if (!fs->use_regex && fs->qlen > 0) {
+            ptrdiff_t hit = find_substr_ci(text, len, fs->query, (size_t)fs->qlen);
+            if (hit >= 0) {
+                attron(A_BOLD | A_UNDERLINE);
+                mvaddnstr(r, 9 + (int)hit, text + hit, fs->qlen);
+                attroff(A_BOLD | A_UNDERLINE);
+            }
+        }
+        if (sel) attroff(A_REVERSE | A_BOLD);
+    }
+    attron(COLOR_PAIR(4));
+    mvhline(max_y - 2, 0, ACS_HLINE, max_x);
+    attroff(COLOR_PAIR(4));
+    char status[128];
+    if (fs->re_state < 0)
+        snprintf(status, sizeof(status), " bad regex  %s ", name);
+    else
+        snprintf(status, sizeof(status), " %zu%s match%s%s  %s ", fs->nmatch,
+                 fs->nmatch >= SEARCH_MATCH_MAX ? "+" : "", fs->nmatch == 1 ? "" : "es",
+                 scanning ? " \u2026" : "", name);
+    attron(COLOR_PAIR(8) | A_BOLD);
+    mvprintw(max_y - 1, max_x - (int)strlen(status) - 1, "%s", status);
+    mvprintw(max_y - 1, 1, "%s %s", fs->use_regex ? "re?" : "?", fs->query);
+    attroff(COLOR_PAIR(8) | A_BOLD);
+    move(max_y - 1, (fs->use_regex ? 5 : 3) + fs->qlen);
+    refresh();
+}
+
+// Built-in `?`: search the selected file in place. The file is never
+// loaded whole, only scanned a window at a time between keystrokes, so even
+// a huge log opens at once and typing stays responsive. Ctrl-R switches
+// between substring and extended regex (both ignore case). On Enter,
+// *out_line is the chosen line number; returns 1 then, 0 if cancelled.
+static int file_search_select_line(FileList *list, int *out_line) {
+    if (!list || !out_line) return -1;
+    *out_line = 0;
+    if (list->selected < 0 || list->selected >= list->count) return 0;
+    uint32_t it = row_entry(list, list->selected);
+    const char *name = entry_name(&list->entries, it);
+    if (list->entries.is_dir[it]) { popup_message("Not a file", "Select a file first."); return 0; }
+    int fd = openat(list->dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return -1; }
+    if (!S_ISREG(st.st_mode)) { close(fd); errno = EINVAL; return -1; }
+    FileSearch *fs = calloc(1, sizeof(*fs));
+    if (!fs) { close(fd); return -1; }
+    fs->fd = fd;
+    fs->size = (size_t)st.st_size;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    int chosen = 0;
+    fs->buf = malloc(SEARCH_CHUNK + SCAN_SLACK);
+    fs->blk = malloc(LINE_BLOCK);
+    fs->nblocks = fs->size / LINE_BLOCK + 1;
+    fs->block_lines = calloc(fs->nblocks, sizeof(*fs->block_lines));
+    if (!fs->buf || !fs->blk || !fs->block_lines) { chosen = -1; goto out; }
+    // The empty query matches every line, so the overlay opens as a view
+    // of the file.
+    int dirty = 1, scanning = 1;
+    curs_set(1);
+    for (;;) {
+        if (scanning) {
+            size_t before = fs->nmatch;
+            scanning = search_pump(fs);
+            if (fs->nmatch != before || !scanning) dirty = 1;
+        }
+        if (dirty) {
+            search_draw(fs, name, scanning);
+            dirty = 0;
+        }
+        int ch = getch();
+        if (ch == ERR) {
+            struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+            poll(&pfd, 1, scanning ? 0 : -1);
+            continue;
+        }
+        dirty = 1;
+        int rows = getmaxy(stdscr) - 2;
+        if (ch == 27 || ch == 3) break;                     // ESC, Ctrl-C
+        if (ch == '\n' || ch == KEY_ENTER) {
+            if ((size_t)fs->selected < fs->nmatch) {
+                uint64_t line = search_line_no(fs, fs->match[fs->selected]);
+                *out_line = line > INT_MAX ? INT_MAX : (int)line;
+                chosen = 1;
+            }
+            break;
+        }
+        if (ch == KEY_UP || ch == 16) {                     // Ctrl-P
+            if (fs->selected > 0) fs->selected--;
+        } else if (ch == KEY_DOWN || ch == 14) {            // Ctrl-N
+            if ((size_t)fs->selected + 1 < fs->nmatch) fs->selected++;
+        } else if (ch == KEY_PPAGE) {
+            fs->selected = fs->selected > rows ? fs->selected - rows : 0;
+        } else if (ch == KEY_NPAGE) {
+            size_t next = (size_t)fs->selected + (size_t)rows;
+            fs->selected = next < fs->nmatch ? (int)next : (fs->nmatch > 0 ? (int)fs->nmatch - 1 : 0);
+        } else if (ch == 18) {                              // Ctrl-R
+            fs->use_regex = !fs->use_regex;
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if (fs->qlen > 0) fs->query[--fs->qlen] = '\0';
+        } else if (ch == 21) {                              // Ctrl-U
+            fs->qlen = 0;
+            fs->query[0] = '\0';
+        } else if (ch >= 32 && ch < 127 && fs->qlen + 1 < (int)sizeof(fs->query)) {
+            fs->query[fs->qlen++] = (char)ch;
+            fs->query[fs->qlen] = '\0';
+        } else {
+            continue;
+        }
+        search_update(fs);
+        scanning = 1;
+    }
+    curs_set(0);
+    clear();
+out:
+    if (fs->re_state > 0) regfree(&fs->re);
+    close(fs->fd);
+    free(fs->buf);
+    free(fs->blk);
+    free(fs->block_lines);
+    free(fs->match);
+    free(fs);
+    return chosen;
+}
+
+// ---- tree grep --------------------------------------------------------
+
+#define GREP_SNIFF_BYTES 8192       // a NUL in here marks a file as binary
+#define GREP_READ_MAX (256 * 1024)  // bytes read per window of a file
+#define GREP_BATCH_HITS 256
+#define GREP_HITS_MAX 100000        // the search stops after this many hits
+#define GREP_TEXT_MAX 240           // bytes of each hit line kept for display
+
+// Hits as a worker batches them and as the overlay keeps them: files
+// that have hits, and per hit its file, line number and trimmed text.
+typedef struct {
+    PathList paths;
+    PathList text;
+    uint32_t *path_of;
+    uint32_t *line;
+    int cap;
+} GrepHits;
+
+typedef struct GrepBatch {
+    struct GrepBatch *next;
+    GrepHits hits;
+} GrepBatch;
+
+// `F`: grep every file under cwd. A TreeWalk lists the tree while the
+// grep workers claim its files one at a time, so reading starts with the
+// first directory and all workers stay busy until the walk runs dry.
+typedef struct {
+    TreeWalk *walk;
+    int root_fd;
+    char query[256];
+    int use_regex;
+    pthread_mutex_t lock;
+    PathTree files;           // walked so far (guarded by lock)
+    int next;                 // next file to claim (guarded by lock)
+    int walk_done;            // guarded by lock
+    GrepBatch *head, *tail;   // guarded by lock
+    int running;              // workers still going (guarded by lock)
+    atomic_int cancel;
+    atomic_int files_read;
+    int nthreads;
+    pthread_t threads[STAT_WORKERS_MAX];
+} GrepJob;
+
+static int grep_hits_add(GrepHits *h, const char *text, size_t len, uint32_t path_of, uint32_t line) {
+    if (h->text.count == h->cap) {
+        int cap = h->cap ? h->cap * 2 : 64;
+        uint32_t *p = realloc(h->path_of, (size_t)cap * sizeof(*p));
+        if (!p) return -1;
+        h->path_of = p;
+        uint32_t *l = realloc(h->line, (size_t)cap * sizeof(*l));
+        if (!l) return -1;
+        h->line = l;
+        h->cap = cap;
+    }
+    if (pathlist_append(&h->text, NULL, 0, text, len, 0) != 0) return -1;
+    h->path_of[h->text.count - 1] = path_of;
+    h->line[h->text.count - 1] = line;
+    return 0;
+}
+
+static void grep_hits_free(GrepHits *h) {
+    pathlist_free(&h->paths);
+    pathlist_free(&h->text);
+    free(h->path_of);
+    free(h->line);
+    memset(h, 0, sizeof(*h));
+}
+
+// One file being grepped: where its text is, and the line count so far
+// (hits arrive in order, so newlines are only ever counted once).
+typedef struct {
+    GrepJob *job;
+    GrepHits *hits;
+    const char *path;
+    const char *data;
+    size_t counted;           // newlines counted up to here...
+    uint32_t line;            // ...and the line number there
+    int file_added;
+} GrepFile;
+
+static int grep_hit(void *ctx, size_t start, size_t end) {
+    GrepFile *g = ctx;
+    g->line += (uint32_t)count_newlines(g->data + g->counted, start - g->counted);
+    g->counted = start;
+    if (!g->file_added) {
+        if (pathlist_append(&g->hits->paths, NULL, 0, g->path, strlen(g->path), 0) != 0) return 1;
+        g->file_added = 1;
+    }
+    char text[GREP_TEXT_MAX];
+    size_t len = end - start < sizeof(text) ? end - start : sizeof(text);
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)g->data[start + i];
+        text[i] = (c < 32 || c == 127) ? ' ' : (char)c;
+    }
+    if (grep_hits_add(g->hits, text, len, (uint32_t)g->hits->paths.count - 1, g->line + 1) != 0) return 1;
+    return atomic_load_explicit(&g->job->cancel, memory_order_relaxed);
+}
+
+// Grep one file relative to the root. buf is the worker's read buffer of
+// GREP_READ_MAX + SCAN_SLACK bytes. The file is read a window at a time,
+// never mapped: trees hold live logs and build outputs, and a file
+// truncated under a mapping would take the process down with SIGBUS.
+// Here it just reads short. Windows end on a line boundary, unless a
+// single line fills one; a match across that cut can be missed.
+static void grep_file(GrepJob *job, const LineQuery *q, const char *path, char *buf, GrepHits *hits) {
+    int fd = openat(job->root_fd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) { close(fd); return; }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    GrepFile g = { .job = job, .hits = hits, .path = path, .data = buf };
+    off_t off = 0;
+    int read_any = 0;
+    for (;;) {
+        int more;
+        size_t len = read_window(fd, buf, GREP_READ_MAX, off, &more);
+        if (len == 0) break;
+        if (off == 0 && memchr(buf, '\0', len < GREP_SNIFF_BYTES ? len : GREP_SNIFF_BYTES)) break;
+        read_any = 1;
+        g.counted = 0;
+        if (match_lines(buf, len, 0, q, grep_hit, &g)) break;
+        g.line += (uint32_t)count_newlines(buf + g.counted, len - g.counted);
+        off += (off_t)len;
+        if (!more) break;
+    }
+    close(fd);
+    if (read_any) atomic_fetch_add_explicit(&job->files_read, 1, memory_order_relaxed);
+}
+
+static void grep_publish(GrepJob *job, GrepBatch **cur) {
+    GrepBatch *b = *cur;
+    if (!b || b->hits.text.count == 0) return;
+    *cur = NULL;
+    if (job->tail) job->tail->next = b;
+    else job->head = b;
+    job->tail = b;
+}
+
+static void *grep_worker(void *arg) {
+    GrepJob *job = arg;
+    regex_t re;
+    LineQuery q = { job->query, strlen(job->query), NULL };
+    if (job->use_regex && q.nlen > 0) {
+        // Each worker compiles its own: regexec locks a shared pattern.
+        if (regcomp(&re, job->query, REG_EXTENDED | REG_ICASE | REG_NOSUB) != 0) goto out;
+        q.re = &re;
+    }
+    char *buf = malloc(GREP_READ_MAX + SCAN_SLACK);
+    GrepBatch *cur = NULL;
+    char path[MAX_PATH];
+    while (buf && !atomic_load(&job->cancel)) {
+        pthread_mutex_lock(&job->lock);
+        if (cur && cur->hits.text.count >= GREP_BATCH_HITS) grep_publish(job, &cur);
+        if (job->next >= job->files.paths.count && !job->walk_done)
+            job->walk_done = walk_take(job->walk, &job->files);
+        int claimed = 0;
+        while (job->next < job->files.paths.count) {
+            int i = job->next++;
+            if (job->files.paths.is_dir[i]) continue;
+            snprintf(path, sizeof(path), "%s", path_at(&job->files.paths, i));
+            claimed = 1;
+            break;
+        }
+        int finished = !claimed && job->walk_done;
+        if (!claimed) grep_publish(job, &cur);
+        pthread_mutex_unlock(&job->lock);
+        if (finished) break;
+        if (!claimed) {
+            struct timespec pause = { 0, 1000000 };   // the walk is behind
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        if (!cur) cur = calloc(1, sizeof(*cur));
+        if (cur) grep_file(job, &q, path, buf, &cur->hits);
+    }
+    free(buf);
+    if (q.re) regfree(&re);
+    pthread_mutex_lock(&job->lock);
+    grep_publish(job, &cur);
+    pthread_mutex_unlock(&job->lock);
+    if (cur) { grep_hits_free(&cur->hits); free(cur); }
+out:
+    pthread_mutex_lock(&job->lock);
+    job->running--;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static GrepJob *grep_start(int dir_fd, const char *root, const char *query, int use_regex, int prune) {
+    GrepJob *job = calloc(1, sizeof(*job));
+    if (!job) return NULL;
+    job->root_fd = dup(dir_fd);
+    job->walk = job->root_fd >= 0 ? walk_start(dir_fd, root, NULL, prune) : NULL;
+    if (!job->walk) {
+        if (job->root_fd >= 0) close(job->root_fd);
+        free(job);
+        return NULL;
+    }
+    snprintf(job->query, sizeof(job->query), "%s", query);
+    job->use_regex = use_regex;
+    pthread_mutex_init(&job->lock, NULL);
+    atomic_init(&job->cancel, 0);
+    atomic_init(&job->files_read, 0);
+    int workers = stat_worker_count();
+    pthread_mutex_lock(&job->lock);
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&job->threads[job->nthreads], NULL, grep_worker, job) != 0) break;
+        job->nthreads++;
+    }
+    job->running = job->nthreads;
+    pthread_mutex_unlock(&job->lock);
+    return job;
+}
+
+// Move the hits found so far into out. Returns 1 once the search is over
+// and everything has been handed out.
+static int grep_take(GrepJob *job, GrepHits *out) {
+    pthread_mutex_lock(&job->lock);
+    GrepBatch *b = job->head;
+    job->head = job->tail = NULL;
+    int done = (job->running == 0);
+    pthread_mutex_unlock(&job->lock);
+    while (b) {
+        GrepBatch *next = b->next;
+        const GrepHits *h = &b->hits;
+        uint32_t base = (uint32_t)out->paths.count;
+        for (int i = 0; i < h->paths.count; i++)
+            pathlist_append(&out->paths, NULL, 0, path_at(&h->paths, i), h->paths.plen[i], 0);
+        for (int i = 0; i < h->text.count; i++) {
+            if (grep_hits_add(out, path_at(&h->text, i), h->text.plen[i], base + h->path_of[i], h->line[i]) != 0) break;
+        }
+        grep_hits_free(&b->hits);
+        free(b);
+        b = next;
+    }
+    return done;
+}
+
+static void grep_free(GrepJob *job) {
+    if (!job) return;
+    atomic_store(&job->cancel, 1);
+    for (int i = 0; i < job->nthreads; i++) pthread_join(job->threads[i], NULL);
+    walk_free(job->walk);
+    GrepHits drop = {0};
+    grep_take(job, &drop);
+    grep_hits_free(&drop);
+    pathtree_free(&job->files);
+    close(job->root_fd);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+static void grep_draw(const GrepHits *hits, int selected, const char *query, int use_regex,
+                      int searching, int files_read, int bad_regex) {
+    int max_y, max_x;
+    getmaxyx(stdscr, max_y, max_x);
+    erase();
+    int rows = max_y - 2;
+    int first = selected >= rows ? selected - rows + 1 : 0;
+    size_t qlen = strlen(query);
+    for (int r = 0; r < rows && first + r < hits->text.count; r++) {
+        int idx = first + r;
+        const char *path = path_at(&hits->paths, (int)hits->path_of[idx]);
+        const char *text = path_at(&hits->text, idx);
+        int sel = (idx == selected);
+        if (sel) attron(A_REVERSE | A_BOLD);
+        mvhline(r, 0, ' ', max_x);
+        char where[64];
+        snprintf(where, sizeof(where), ":%u: ", hits->line[idx]);
+        int col = 1, room = max_x - 2;
+        if (!sel) attron(COLOR_PAIR(1));
+        mvaddnstr(r, col, path, room);
+        if (!sel) attroff(COLOR_PAIR(1));
+        col += (int)strlen(path);
+        if (col < max_x - 1) {
+            if (!sel) attron(COLOR_PAIR(6));
+            mvaddnstr(r, col, where, max_x - 1 - col);
+            if (!sel) attroff(COLOR_PAIR(6));
+            col += (int)strlen(where);
+        }
+        if (col < max_x - 1) {
+            int len = hits->text.plen[idx];
+            mvaddnstr(r, col, text, max_x - 1 - col);
+            ptrdiff_t hit = use_regex ? -1 : find_substr_ci(text, (size_t)len, query, qlen);
+            if (hit >= 0 && qlen > 0 && col + hit < max_x - 1) {
+                attron(A_BOLD | A_UNDERLINE);
+                mvaddnstr(r, col + (int)hit, text + hit, (int)qlen);
+                attroff(A_BOLD | A_UNDERLINE);
+            }
+        }
+        if (sel) attroff(A_REVERSE | A_BOLD);
+    }
+    attron(COLOR_PAIR(4));
+    mvhline(max_y - 2, 0, ACS_HLINE, max_x);
+    attroff(COLOR_PAIR(4));
+    char status[128];
+    if (bad_regex)
+        snprintf(status, sizeof(status), " bad regex ");
+    else
+        snprintf(status, sizeof(status), " %d%s hit%s in %d file%s, %d read%s ",
+                 hits->text.count, hits->text.count >= GREP_HITS_MAX ? "+" : "",
+                 hits->text.count == 1 ? "" : "s", hits->paths.count, hits->paths.count == 1 ? "" : "s",
+                 files_read, searching ? " \u2026" : "");
+    attron(COLOR_PAIR(8) | A_BOLD);
+    mvprintw(max_y - 1, max_x - (int)strlen(status) - 1, "%s", status);
+    mvprintw(max_y - 1, 1, "%s %s", use_regex ? "re F" : "F", query);
+    attroff(COLOR_PAIR(8) | A_BOLD);
+    move(max_y - 1, (use_regex ? 6 : 3) + (int)qlen);
+    refresh();
+}
+
+// `F`: search the contents of every file under cwd. Enter runs the typed
+// query (Ctrl-R: as a regex) and, once the results are for it, opens the
+// selected hit; ESC stops a running search, or closes the overlay. On a
+// choice, the hit's path (relative to cwd) goes to out and its line to
+// *out_line; returns 1 then, 0 if cancelled, -1 on error.
+static int grep_tree(FileList *list, char *out, size_t out_len, int *out_line) {
+    GrepHits hits = {0};
+    GrepJob *job = NULL;
+    char query[256] = "", ran[256] = "";
+    int qlen = 0, use_regex = 0, ran_regex = 0, selected = 0, searching = 0;
+    int bad_regex = 0, files_read = 0, chosen = 0, dirty = 1;
+    curs_set(1);
+    for (;;) {
+        if (job && searching) {
+            int before = hits.text.count;
+            searching = !grep_take(job, &hits);
+            files_read = atomic_load(&job->files_read);
+            if (hits.text.count >= GREP_HITS_MAX) {
+                atomic_store(&job->cancel, 1);
+                searching = 0;
+            }
+            if (hits.text.count != before || !searching) dirty = 1;
+        }
+        if (dirty) {
+            grep_draw(&hits, selected, query, use_regex, searching, files_read, bad_regex);
+            dirty = 0;
+        }
+        int ch = getch();
+        if (ch == ERR) {
+            struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+            poll(&pfd, 1, searching ? BACKGROUND_TICK_MS : -1);
+            if (searching) dirty = 1;
+            continue;
+        }
+        dirty = 1;
+        int rows = getmaxy(stdscr) - 2;
+        if (ch == 27 || ch == 3) {                          // ESC, Ctrl-C
+            if (!searching) break;
+            atomic_store(&job->cancel, 1);
+            searching = 0;
+        } else if (ch == '\n' || ch == KEY_ENTER) {
+            if (ran[0] && strcmp(ran, query) == 0 && ran_regex == use_regex) {
+                if (selected < hits.text.count) {
+                    snprintf(out, out_len, "%s", path_at(&hits.paths, (int)hits.path_of[selected]));
+                    *out_line = (int)hits.line[selected];
+                    chosen = 1;
+                    break;
+                }
+                continue;
+            }
+            if (qlen == 0) continue;
+            grep_free(job);
+            job = NULL;
+            grep_hits_free(&hits);
+            selected = 0;
+            files_read = 0;
+            memcpy(ran, query, sizeof(ran));
+            ran_regex = use_regex;
+            bad_regex = 0;
+            if (use_regex) {
+                regex_t re;
+                bad_regex = regcomp(&re, query, REG_EXTENDED | REG_NOSUB) != 0;
+                if (!bad_regex) regfree(&re);
+            }
+            if (bad_regex) continue;
+            job = grep_start(list->dir_fd, list->cwd, query, use_regex, !list->show_ignored);
+            if (!job) { chosen = -1; break; }
+            searching = 1;
+        } else if (ch == KEY_UP || ch == 16) {              // Ctrl-P
+            if (selected > 0) selected--;
+        } else if (ch == KEY_DOWN || ch == 14) {            // Ctrl-N
+            if (selected + 1 < hits.text.count) selected++;
+        } else if (ch == KEY_PPAGE) {
+            selected = selected > rows ? selected - rows : 0;
+        } else if (ch == KEY_NPAGE) {
+            selected += rows;
+            if (selected >= hits.text.count) selected = hits.text.count > 0 ? hits.text.count - 1 : 0;
+        } else if (ch == 18) {                              // Ctrl-R
+            use_regex = !use_regex;
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if (qlen > 0) query[--qlen] = '\0';
+        } else if (ch == 21) {                              // Ctrl-U
+            qlen = 0;
+            query[0] = '\0';
+        } else if (ch >= 32 && ch < 127 && qlen + 1 < (int)sizeof(query)) {
+            query[qlen++] = (char)ch;
+            query[qlen] = '\0';
+        }
+    }
+    curs_set(0);
+    grep_free(job);
+    grep_hits_free(&hits);
+    clear();
+    return chosen;
+}
+
+// ---- frecency ---------------------------------------------------------
+
+// Directories visited, for the `z` jump and `goto <query>`. The store is
+// an append-only log, $XDG_DATA_HOME/goto/frecency (or ~/.local/share):
+//
+//   FrecencyHeader, then records of
+//   FrecencyRecord, path, zero padding to 8 bytes
+//
+// A visit is a single O_APPEND write of one record, so goto processes
+// running side by side never interleave. Readers map the log and fold
+// the records of each path. Once the log has grown well past its size at
+// the last compaction it is rewritten with one record per directory that
+// still exists, under an exclusive flock, and renamed over the old one.
+// That stats every recorded directory, so it waits for exit rather than
+// holding up navigation.
+#define FRECENCY_MAGIC "GOTOFRC1"
+#define FRECENCY_COMPACT_SLACK (64 * 1024)  // log growth tolerated past twice its compacted size
+#define FRECENCY_WEIGHT_MAX 10000   // beyond this total, compaction ages every weight by 10%
+#define FRECENCY_TOP_MAX 512
+
+typedef struct {
+    char magic[8];
+    uint64_t compacted;       // log size right after the last compaction
+} FrecencyHeader;
+
+typedef struct {
+    uint32_t last;            // unix time of the visit
+    uint32_t weight;
+    uint32_t len;             // path bytes that follow
+} FrecencyRecord;
+
+typedef struct {
+    PathList paths;           // one per directory
+    uint32_t *last;
+    uint32_t *weight;
+    int cap;
+    uint32_t *slot;           // path hash -> index, UINT32_MAX if empty
+    uint32_t mask;
+    uint64_t total;           // sum of weights
+} Frecency;
+
+static int g_frecency_fd = -1;      // the log, opened for appending on first visit
+static off_t g_frecency_compact_at;
+static int g_frecency_compact_due;  // the log outgrew g_frecency_compact_at
+
+static int frecency_file_path(char *out, size_t out_len) {
+    const char *xdg = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+    char dir[MAX_PATH];
+    int ret;
+    if (xdg && xdg[0] == '/') {
+        ret = snprintf(dir, sizeof(dir), "%s/goto", xdg);
+    } else if (home && *home) {
+        ret = snprintf(dir, sizeof(dir), "%s/.local/share/goto", home);
+    } else {
+        errno = ENOENT;
+        return -1;
+    }
+    if (ret < 0 || ret >= (int)sizeof(dir)) { errno = ENAMETOOLONG; return -1; }
+    // create every missing directory on the way
+    for (char *p = dir + 1; ; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char c = *p;
+        *p = '\0';
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST) return -1;
+        *p = c;
+        if (!c) break;
+    }
+    ret = snprintf(out, out_len, "%s/frecency", dir);
+    if (ret < 0 || ret >= (int)out_len) { errno = ENAMETOOLONG; return -1; }
+    return 0;
+}
+
+static void frecency_free(Frecency *fr) {
+    pathlist_free(&fr->paths);
+    free(fr->last);
+    free(fr->weight);
+    free(fr->slot);
+    memset(fr, 0, sizeof(*fr));
+}
+
+static int frecency_add(Frecency *fr, const char *path, size_t len, uint32_t last, uint32_t weight) {
+    if ((uint32_t)fr->paths.count * 2 >= fr->mask) {
+        uint32_t cap = fr->mask ? (fr->mask + 1) * 2 : 1024;
+        uint32_t *slot = malloc((size_t)cap * sizeof(*slot));
+        if (!slot) return -1;
+        memset(slot, 0xff, (size_t)cap * sizeof(*slot));
+        for (int i = 0; i < fr->paths.count; i++) {
+            uint32_t s = (uint32_t)hash_bytes(path_at(&fr->paths, i), fr->paths.plen[i]) & (cap - 1);
+            while (slot[s] != UINT32_MAX) s = (s + 1) & (cap - 1);
+            slot[s] = (uint32_t)i;
         }
-        return 0;
+        free(fr->slot);
+        fr->slot = slot;
+        fr->mask = cap - 1;
     }
-    return unlink(item->full_path);
-}
-static int rename_item(const FileItem *item, const char *new_name) {
-    if (!new_name || !*new_name || strchr(new_name, '/') ||
-        strcmp(new_name, ".") == 0 || strcmp(new_name, "..") == 0) {
-        errno = EINVAL; return -1;
+    uint32_t s = (uint32_t)hash_bytes(path, len) & fr->mask;
+    for (; fr->slot[s] != UINT32_MAX; s = (s + 1) & fr->mask) {
+        uint32_t i = fr->slot[s];
+        if (fr->paths.plen[i] == len && memcmp(path_at(&fr->paths, (int)i), path, len) == 0) {
+            if (last > fr->last[i]) fr->last[i] = last;
+            fr->weight[i] += weight;
+            fr->total += weight;
+            return 0;
+        }
     }
-    char dirbuf[MAX_PATH];
-    strncpy(dirbuf, item->full_path, sizeof(dirbuf) - 1);
-    dirbuf[sizeof(dirbuf) - 1] = '\0';
-    char *slash = strrchr(dirbuf, '/');
-    if (!slash) { errno = EINVAL; return -1; }
-    *slash = '\0';
-    char new_path[MAX_PATH];
-    int ret = snprintf(new_path, sizeof(new_path), "%s/%s", dirbuf, new_name);
-    if (ret < 0 || ret >= (int)sizeof(new_path)) { errno = ENAMETOOLONG; return -1; }
-    return rename(item->full_path, new_path);
-}
-
-const char* get_file_icon(FileItem *item) {
-    if (item->is_dir) {
-        if (strcmp(item->name, ".git") == 0) return ICON_GIT;
-        if (item->is_hidden) return ICON_HIDDEN;
-        return ICON_FOLDER;
-    }
-    const char *ext = strrchr(item->name, '.');
-    if (!ext) {
-        if (item->mode & S_IXUSR) return ICON_EXEC;
-        return ICON_FILE;
-    }
-    if (strcmp(ext, ".c") == 0 || strcmp(ext, ".h") == 0) return ICON_C;
-    if (strcmp(ext, ".py") == 0) return ICON_PYTHON;
-    if (strcmp(ext, ".js") == 0 || strcmp(ext, ".ts") == 0) return ICON_JS;
-    if (strcmp(ext, ".jsx") == 0 || strcmp(ext, ".tsx") == 0) return ICON_JS;
-    if (strcmp(ext, ".rs") == 0) return ICON_RUST;
-    if (strcmp(ext, ".go") == 0) return ICON_GO;
-    if (strcmp(ext, ".json") == 0) return ICON_JSON;
-    if (strcmp(ext, ".md") == 0) return ICON_MD;
-    if (strcmp(ext, ".yaml") == 0 || strcmp(ext, ".yml") == 0) return ICON_YAML;
-    if (strcmp(ext, ".sh") == 0 || strcmp(ext, ".bash") == 0 || strcmp(ext, ".zsh") == 0) return ICON_SH;
-    if (strcmp(ext, ".png") == 0 || strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0 || strcmp(ext, ".gif") == 0) return ICON_IMG;
-    return ICON_FILE;
-}
-
-int get_file_color(FileItem *item) {
-    if (item->is_dir) return 1;
-    if (item->mode & S_IXUSR) return 2;
-    const char *ext = strrchr(item->name, '.');
-    if (!ext) return 4;
-    if (strcmp(ext, ".c") == 0 || strcmp(ext, ".h") == 0) return 5;
-    if (strcmp(ext, ".py") == 0) return 6;
-    if (strcmp(ext, ".js") == 0 || strcmp(ext, ".ts") == 0) return 2;
-    if (strcmp(ext, ".rs") == 0) return 7;
-    if (strcmp(ext, ".md") == 0) return 6;
-    return 4;
-}
-
-static const char* file_ext(const char *name) {
-    const char *ext = strrchr(name, '.');
-    if (!ext || ext == name) return "";
-    return ext + 1;
+    if (fr->paths.count == fr->cap) {
+        int cap = fr->cap ? fr->cap * 2 : 256;
+        uint32_t *l = realloc(fr->last, (size_t)cap * sizeof(*l));
+        if (!l) return -1;
+        fr->last = l;
+        uint32_t *w = realloc(fr->weight, (size_t)cap * sizeof(*w));
+        if (!w) return -1;
+        fr->weight = w;
+        fr->cap = cap;
+    }
+    if (pathlist_append(&fr->paths, NULL, 0, path, len, 1) != 0) return -1;
+    fr->slot[s] = (uint32_t)(fr->paths.count - 1);
+    fr->last[fr->paths.count - 1] = last;
+    fr->weight[fr->paths.count - 1] = weight;
+    fr->total += weight;
+    return 0;
 }
 
-static int compare_items(const void *a, const void *b, void *ctx) {
-    const FileList *list = (const FileList*)ctx;
-    const FileItem *A = (const FileItem*)a;
-    const FileItem *B = (const FileItem*)b;
-    if (A->is_dir != B->is_dir) {
-        int r = (B->is_dir - A->is_dir);
-        return list->sort_reverse ? -r : r;
-    }
-    int r = 0;
-    switch (list->sort_mode) {
-        case SORT_NAME: r = strcasecmp(A->name, B->name); break;
-        case SORT_SIZE:
-            if (A->size < B->size) r = -1;
-            else if (A->size > B->size) r = 1;
-            else r = strcasecmp(A->name, B->name);
-            break;
-        case SORT_TIME:
-            if (A->mtime < B->mtime) r = -1;
-            else if (A->mtime > B->mtime) r = 1;
-            else r = strcasecmp(A->name, B->name);
-            break;
-        case SORT_EXT: {
-            const char *ea = file_ext(A->name);
-            const char *eb = file_ext(B->name);
-            r = strcasecmp(ea, eb);
-            if (r == 0) r = strcasecmp(A->name, B->name);
-            break;
+// Fold the log open on fd into fr. A torn or foreign tail is ignored.
+static int frecency_read(Frecency *fr, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    size_t size = (size_t)st.st_size;
+    if (size < sizeof(FrecencyHeader)) return 0;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return -1;
+    if (memcmp(map, FRECENCY_MAGIC, 8) == 0) {
+        size_t at = sizeof(FrecencyHeader);
+        while (at + sizeof(FrecencyRecord) <= size) {
+            FrecencyRecord r;
+            memcpy(&r, map + at, sizeof(r));
+            size_t n = pad8(sizeof(r) + r.len);
+            if (r.len == 0 || r.len >= MAX_PATH || n > size - at) break;
+            frecency_add(fr, map + at + sizeof(r), r.len, r.last, r.weight);
+            at += n;
         }
-        default: r = strcasecmp(A->name, B->name); break;
     }
-    return list->sort_reverse ? -r : r;
+    munmap(map, size);
+    return 0;
 }
 
-#if defined(__APPLE__)
-static int compare_items_wrapper(void *ctx, const void *a, const void *b) {
-    return compare_items(a, b, ctx);
-}
-static void sort_items_portable(FileList *list) {
-    qsort_r(list->items, list->count, sizeof(FileItem), list, compare_items_wrapper);
-}
-#elif defined(__GLIBC__)
-static int compare_items_wrapper(const void *a, const void *b, void *ctx) {
-    return compare_items(a, b, ctx);
-}
-static void sort_items_portable(FileList *list) {
-    qsort_r(list->items, list->count, sizeof(FileItem), compare_items_wrapper, list);
-}
-#else
-static FileList *g_sort_ctx = NULL;
-static int compare_items_static(const void *a, const void *b) {
-    return compare_items(a, b, g_sort_ctx);
+// Load every directory on record; an empty store is not an error.
+static int frecency_load(Frecency *fr) {
+    char file[MAX_PATH];
+    if (frecency_file_path(file, sizeof(file)) != 0) return -1;
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT ? 0 : -1;
+    int ret = frecency_read(fr, fd);
+    close(fd);
+    return ret;
 }
-static void sort_items_portable(FileList *list) {
-    sigset_t block, old;
-    sigfillset(&block);
-    sigprocmask(SIG_BLOCK, &block, &old);
-    g_sort_ctx = list;
-    qsort(list->items, list->count, sizeof(FileItem), compare_items_static);
-    g_sort_ctx = NULL;
-    sigprocmask(SIG_SETMASK, &old, NULL);
+
+// Weight scaled by how recently the directory was last visited.
+static double frecency_rank(const Frecency *fr, int i, time_t now) {
+    double w = fr->weight[i];
+    time_t age = now - (time_t)fr->last[i];
+    if (age < 3600) return w * 4;
+    if (age < 86400) return w * 2;
+    if (age < 7 * 86400) return w / 2;
+    return w / 4;
 }
-#endif
-static int ff_grep_selected_file(FileList *list, int *out_line) {
-    if (!list || !out_line) return -1;
-    *out_line = 0;
-    if (list->selected < 0 || list->selected >= list->count) return 0;
-    FileItem *it = &list->items[list->selected];
-    if (it->is_dir) { popup_message("Not a file", "Select a file first."); return 0; }
-    if (strcmp(it->name, ".") == 0 || strcmp(it->name, "..") == 0) {
-        popup_message("Nope", "Refusing to search '.' or '..'.");
-        return 0;
-    }
-    if (!command_exists("ff")) {
-        popup_message("Missing ff", "Install `ff` or put it in PATH.");
-        return 0;
+
+// Rewrite the log with one record per directory that still exists,
+// ageing the weights once they add up past FRECENCY_WEIGHT_MAX. Only
+// paths that are gone or no longer directories are dropped; one that is
+// merely unreadable or on an unreachable mount right now is kept.
+static void frecency_compact(void) {
+    char file[MAX_PATH], tmp[MAX_PATH];
+    if (frecency_file_path(file, sizeof(file)) != 0) return;
+    int ret = snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid());
+    if (ret < 0 || ret >= (int)sizeof(tmp)) return;
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    Frecency fr = {0};
+    char *buf = NULL;
+    struct stat a, b;
+    flock(fd, LOCK_EX);
+    // another process may have compacted it while we waited for the lock
+    if (fstat(fd, &a) != 0 || stat(file, &b) != 0 || a.st_ino != b.st_ino) goto out;
+    if (frecency_read(&fr, fd) != 0) goto out;
+    int age = fr.total > FRECENCY_WEIGHT_MAX;
+    size_t size = sizeof(FrecencyHeader);
+    for (int i = 0; i < fr.paths.count; i++) size += pad8(sizeof(FrecencyRecord) + fr.paths.plen[i]);
+    buf = calloc(1, size);
+    if (!buf) goto out;
+    size_t at = sizeof(FrecencyHeader);
+    for (int i = 0; i < fr.paths.count; i++) {
+        FrecencyRecord r = { fr.last[i], age ? fr.weight[i] * 9 / 10 : fr.weight[i], fr.paths.plen[i] };
+        struct stat st;
+        if (r.weight == 0) continue;
+        if (stat(path_at(&fr.paths, i), &st) == 0 ? !S_ISDIR(st.st_mode)
+                                                   : errno == ENOENT || errno == ENOTDIR) continue;
+        memcpy(buf + at, &r, sizeof(r));
+        memcpy(buf + at + sizeof(r), path_at(&fr.paths, i), r.len);
+        at += pad8(sizeof(r) + r.len);
     }
-    char tmp_out[] = "/tmp/goto_ff_linepick_XXXXXX";
-    int fd = mkstemp(tmp_out);
-    if (fd < 0) return -1;
+    FrecencyHeader h = { FRECENCY_MAGIC, at };
+    memcpy(buf, &h, sizeof(h));
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) goto out;
+    int bad = write(out, buf, at) != (ssize_t)at;
+    if (close(out) != 0 || bad || rename(tmp, file) != 0) unlink(tmp);
+out:
+    flock(fd, LOCK_UN);
     close(fd);
-    register_temp_file(tmp_out);
-    char qcwd[QUOTE_BUF_SIZE], qfile[QUOTE_BUF_SIZE], qout[QUOTE_BUF_SIZE];
-    shell_quote_single(qcwd,  sizeof(qcwd),  list->cwd);
-    shell_quote_single(qfile, sizeof(qfile), it->full_path);
-    shell_quote_single(qout,  sizeof(qout),  tmp_out);
-    char cmd[16384];
-    int ret = snprintf(cmd, sizeof(cmd),
-        "sh -lc \""
-        "cd %s || exit 1; "
-        "nl -ba -- %s | ff > %s 2> /dev/tty"
-        "\"",
-        qcwd, qfile, qout);
-    if (ret < 0 || ret >= (int)sizeof(cmd)) { unlink(tmp_out); return -1; }
-    fflush(stdout); fflush(stderr);
-    def_prog_mode();
-    endwin();
-    int sys_rc = system(cmd);
-    reset_prog_mode();
-    refresh();
-    clear();
-    if (sys_rc == -1) { unlink(tmp_out); return -1; }
-    int exit_code = 0;
-    if (WIFEXITED(sys_rc)) exit_code = WEXITSTATUS(sys_rc);
-    else { unlink(tmp_out); return 0; }
-    if (exit_code != 0) { unlink(tmp_out); return 0; }
-    FILE *fp = fopen(tmp_out, "r");
-    if (!fp) { unlink(tmp_out); return -1; }
-    char sel[4096] = {0};
-    if (!fgets(sel, sizeof(sel), fp)) { fclose(fp); unlink(tmp_out); return 0; }
-    fclose(fp);
-    unlink(tmp_out);
-    sel[strcspn(sel, "\r\n")] = '\0';
-    if (sel[0] == '\0') return 0;
-    char *p = sel;
-    while (*p && isspace((unsigned char)*p)) p++;
-    long ln = strtol(p, NULL, 10);
-    if (ln <= 0) return 0;
-    *out_line = (int)ln;
-    return 1;
+    free(buf);
+    frecency_free(&fr);
 }
 
-static int passes_filter(const FileList *list, const FileItem *item) {
-    switch (list->filter_mode) {
-        case FILTER_ALL:      return 1;
-        case FILTER_FILES:    return !item->is_dir;
-        case FILTER_DIRS:     return item->is_dir;
-        case FILTER_CONTAINS:
-            if (list->filter_text[0] == '\0') return 1;
-            return strstr(item->name, list->filter_text) != NULL;
-        default: return 1;
+static void frecency_open_log(void) {
+    if (g_frecency_fd >= 0) close(g_frecency_fd);
+    g_frecency_fd = -1;
+    char file[MAX_PATH];
+    if (frecency_file_path(file, sizeof(file)) != 0) return;
+    int fd = open(file, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    FrecencyHeader h = {0};
+    flock(fd, LOCK_EX);
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            memcpy(h.magic, FRECENCY_MAGIC, 8);
+            h.compacted = sizeof(h);
+            if (write(fd, &h, sizeof(h)) != (ssize_t)sizeof(h)) h.compacted = 0;
+        }
+    }
+    flock(fd, LOCK_UN);
+    if (memcmp(h.magic, FRECENCY_MAGIC, 8) != 0) {   // not ours: leave it alone
+        close(fd);
+        return;
     }
+    g_frecency_fd = fd;
+    g_frecency_compact_at = (off_t)(2 * h.compacted + FRECENCY_COMPACT_SLACK);
 }
 
-int load_directory(FileList *list, const char *path) {
-    DIR *dir = opendir(path);
-    if (!dir) return -1;
-    list->count = 0;
-    list->selected = 0;
-    list->scroll_offset = 0;
-    char resolved[MAX_PATH];
-    if (realpath(path, resolved)) {
-        strncpy(list->cwd, resolved, MAX_PATH - 1);
-        list->cwd[MAX_PATH - 1] = '\0';
-    } else {
-        strncpy(list->cwd, path, MAX_PATH - 1);
-        list->cwd[MAX_PATH - 1] = '\0';
-    }
-    if (chdir(list->cwd) != 0) { closedir(dir); return -1; }
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL && list->count < MAX_ITEMS) {
-        int is_hidden = (entry->d_name[0] == '.');
-        if (is_hidden && !list->show_hidden) continue;
-        FileItem tmp = (FileItem){0};
-        strncpy(tmp.name, entry->d_name, 255);
-        tmp.name[255] = '\0';
-        int ret = snprintf(tmp.full_path, MAX_PATH, "%s/%s", list->cwd, entry->d_name);
-        if (ret < 0 || ret >= MAX_PATH) continue;
+// Record a visit to the absolute directory path.
+static void frecency_visit(const char *path, uint32_t weight) {
+    size_t len = strlen(path);
+    if (len == 0 || path[0] != '/' || len >= MAX_PATH) return;
+    if (g_frecency_fd < 0) frecency_open_log();
+    if (g_frecency_fd < 0) return;
+    char rec[sizeof(FrecencyRecord) + MAX_PATH + 8] = {0};
+    FrecencyRecord r = { (uint32_t)time(NULL), weight, (uint32_t)len };
+    memcpy(rec, &r, sizeof(r));
+    memcpy(rec + sizeof(r), path, len);
+    size_t n = pad8(sizeof(r) + len);
+    // A log that was compacted by another process while we held it has
+    // been renamed over; append to the one that replaced it instead.
+    for (;;) {
         struct stat st;
-        if (lstat(tmp.full_path, &st) == 0) {
-            tmp.mode = st.st_mode;
-            tmp.size = st.st_size;
-            tmp.mtime = st.st_mtime;
-            tmp.is_dir = S_ISDIR(st.st_mode);
-        }
-        tmp.is_hidden = is_hidden;
-        if (!passes_filter(list, &tmp)) continue;
-        list->items[list->count++] = tmp;
+        flock(g_frecency_fd, LOCK_SH);
+        if (fstat(g_frecency_fd, &st) != 0 || st.st_nlink > 0) break;
+        flock(g_frecency_fd, LOCK_UN);
+        frecency_open_log();
+        if (g_frecency_fd < 0) return;
     }
-    closedir(dir);
-    sort_items_portable(list);
-    return 0;
+    ssize_t wrote = write(g_frecency_fd, rec, n);
+    off_t end = lseek(g_frecency_fd, 0, SEEK_CUR);
+    flock(g_frecency_fd, LOCK_UN);
+    if (wrote == (ssize_t)n && end > g_frecency_compact_at) g_frecency_compact_due = 1;
 }
 
-void format_size(off_t size, char *buf, size_t len) {
-    if (size < 1024) snprintf(buf, len, "%lldB", (long long)size);
-    else if (size < 1024 * 1024) snprintf(buf, len, "%.1fK", size / 1024.0);
-    else if (size < 1024 * 1024 * 1024) snprintf(buf, len, "%.1fM", size / (1024.0 * 1024.0));
-    else snprintf(buf, len, "%.1fG", size / (1024.0 * 1024.0 * 1024.0));
+// At exit: compact the log if a visit found it overgrown.
+static void frecency_finish(void) {
+    if (g_frecency_fd >= 0) close(g_frecency_fd);
+    g_frecency_fd = -1;
+    if (g_frecency_compact_due) frecency_compact();
+    g_frecency_compact_due = 0;
 }
 
-static const char* sort_label(SortMode m) {
-    switch (m) {
-        case SORT_NAME: return "name";
-        case SORT_SIZE: return "size";
-        case SORT_TIME: return "time";
-        case SORT_EXT:  return "ext";
-        default: return "name";
-    }
+typedef struct {
+    double score;
+    uint32_t idx;
+} JumpHit;
+
+static int jump_hit_cmp(const void *a, const void *b) {
+    const JumpHit *x = a, *y = b;
+    if (x->score != y->score) return x->score < y->score ? 1 : -1;
+    return x->idx < y->idx ? -1 : x->idx > y->idx;
 }
 
-static void filter_label(const FileList *list, char *out, size_t out_len) {
-    switch (list->filter_mode) {
-        case FILTER_ALL:   snprintf(out, out_len, "all"); break;
-        case FILTER_FILES: snprintf(out, out_len, "files"); break;
-        case FILTER_DIRS:  snprintf(out, out_len, "dirs"); break;
-        case FILTER_CONTAINS:
-            if (list->filter_text[0] == '\0') snprintf(out, out_len, "contains:*");
-            else snprintf(out, out_len, "contains:%s", list->filter_text);
-            break;
-        default: snprintf(out, out_len, "all"); break;
+// Directories matching the lowercase query q, best first: fuzzy score
+// times frecency. skip (may be NULL) is left out.
+static int jump_match(const Frecency *fr, const char *q, int qlen, const char *skip, uint32_t *top, int max) {
+    JumpHit *hits = malloc((size_t)(fr->paths.count + 1) * sizeof(*hits));
+    if (!hits) return 0;
+    time_t now = time(NULL);
+    int n = 0;
+    for (int i = 0; i < fr->paths.count; i++) {
+        const char *s = path_at(&fr->paths, i);
+        if (skip && strcmp(s, skip) == 0) continue;
+        int f = fuzzy_score(s, fr->paths.plen[i], q, qlen, NULL);
+        if (f == 0) continue;
+        hits[n].score = f * frecency_rank(fr, i, now);
+        hits[n].idx = (uint32_t)i;
+        n++;
     }
+    qsort(hits, (size_t)n, sizeof(*hits), jump_hit_cmp);
+    if (n > max) n = max;
+    for (int i = 0; i < n; i++) top[i] = hits[i].idx;
+    free(hits);
+    return n;
 }
 
-void draw_status_bar(FileList *list) {
+static void jump_draw(const Frecency *fr, const uint32_t *top, int ntop, int selected, const char *q, int qlen) {
     int max_y, max_x;
     getmaxyx(stdscr, max_y, max_x);
+    erase();
+    int rows = max_y - 2;
+    int first = selected >= rows ? selected - rows + 1 : 0;
+    int pos[256];
+    for (int r = 0; r < rows && first + r < ntop; r++) {
+        int idx = first + r;
+        const char *s = path_at(&fr->paths, (int)top[idx]);
+        int len = fr->paths.plen[top[idx]];
+        fuzzy_score(s, len, q, qlen, pos);
+        int sel = (idx == selected);
+        if (sel) attron(A_REVERSE | A_BOLD);
+        else attron(COLOR_PAIR(1));
+        mvhline(r, 0, ' ', max_x);
+        mvprintw(r, 1, "%.*s", max_x - 2, s);
+        if (!sel) attron(A_BOLD | A_UNDERLINE);
+        for (int j = 0; j < qlen; j++) {
+            if (pos[j] < max_x - 2) mvaddch(r, 1 + pos[j], (unsigned char)s[pos[j]]);
+        }
+        attroff(A_BOLD | A_UNDERLINE | A_REVERSE | COLOR_PAIR(1));
+    }
     attron(COLOR_PAIR(4));
     mvhline(max_y - 2, 0, ACS_HLINE, max_x);
     attroff(COLOR_PAIR(4));
-    move(max_y - 1, 0);
-    clrtoeol();
+    char status[64];
+    snprintf(status, sizeof(status), " %d/%d ", ntop, fr->paths.count);
     attron(COLOR_PAIR(8) | A_BOLD);
-    mvprintw(max_y - 1, 1, "NBL GoTo | mode: NORMAL |");
-    mvprintw(max_y - 1, 25, " dir:  %s", list->cwd);
-    char filt[300];
-    filter_label(list, filt, sizeof(filt));
-    char status[256];
-    snprintf(status, sizeof(status),
-             "Hidden:%s  Sort:%s%s  Filter:%s  %d/%d ",
-             list->show_hidden ? "ON" : "OFF",
-             sort_label(list->sort_mode),
-             list->sort_reverse ? " (rev)" : "",
-             filt,
-             (list->count > 0 ? list->selected + 1 : 0),
-             list->count);
     mvprintw(max_y - 1, max_x - (int)strlen(status) - 1, "%s", status);
+    mvprintw(max_y - 1, 1, "z %s", q);
     attroff(COLOR_PAIR(8) | A_BOLD);
-}
-
-void draw_ui(FileList *list) {
-    clear();
-    int max_y, max_x;
-    getmaxyx(stdscr, max_y, max_x);
-    int visible_lines = max_y - 3;
-    for (int i = 0; i < visible_lines && i + list->scroll_offset < list->count; i++) {
-        int idx = i + list->scroll_offset;
-        FileItem *item = &list->items[idx];
-        if (idx == list->selected) attron(A_REVERSE | A_BOLD);
-        const char *icon = get_file_icon(item);
-        int color = get_file_color(item);
-        if (idx != list->selected) attron(COLOR_PAIR(color));
-        mvprintw(i, 1, "%s  %-*s", icon, max_x - 20, item->name);
-        if (!item->is_dir) {
-            char size_str[16];
-            format_size(item->size, size_str, sizeof(size_str));
-            mvprintw(i, max_x - 12, "%10s", size_str);
-        }
-        if (idx == list->selected) attroff(A_REVERSE | A_BOLD);
-        else attroff(COLOR_PAIR(color));
-    }
-    draw_status_bar(list);
+    move(max_y - 1, 3 + qlen);
     refresh();
 }
 
-// -----------------------------------------------------------------------
-// BUG 1 FIX: fuzzy_select_path
-// Previously `fz` was spliced directly into the shell command string.
-// pick_fuzzy_tool() currently only returns "ff" or "fzf" so no real
-// injection risk existed, but we now quote it with shell_quote_single()
-// so that future changes to pick_fuzzy_tool() cannot introduce a hole.
-// -----------------------------------------------------------------------
-static int fuzzy_select_path(FileList *list, char *out, size_t out_len) {
-    const char *fz = pick_fuzzy_tool();
-    if (!fz) {
-        int ok = manual_select_in_list(list);
-        if (ok && list->selected >= 0 && list->selected < list->count) {
-            strncpy(out, list->items[list->selected].name, out_len - 1);
-            out[out_len - 1] = '\0';
-            return 1;
+// `z`: pick a directory visited before, ranked by frecency and fuzzy
+// match. Writes it to out; returns 1 if one was chosen, 0 if cancelled.
+static int jump_select_dir(FileList *list, char *out, size_t out_len) {
+    Frecency fr = {0};
+    if (frecency_load(&fr) != 0) return -1;
+    static uint32_t top[FRECENCY_TOP_MAX];
+    char query[256] = "";
+    int qlen = 0, selected = 0, chosen = 0;
+    curs_set(1);
+    for (;;) {
+        int ntop = jump_match(&fr, query, qlen, list->cwd, top, FRECENCY_TOP_MAX);
+        if (selected >= ntop) selected = ntop > 0 ? ntop - 1 : 0;
+        jump_draw(&fr, top, ntop, selected, query, qlen);
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        int ch = getch();
+        if (ch == ERR) {
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (ch == 27 || ch == 3) break;                   // ESC, Ctrl-C
+        if (ch == '\n' || ch == KEY_ENTER) {
+            if (ntop > 0) {
+                snprintf(out, out_len, "%s", path_at(&fr.paths, (int)top[selected]));
+                chosen = 1;
+            }
+            break;
+        }
+        if (ch == KEY_UP || ch == 16 || ch == 11) {         // Ctrl-P, Ctrl-K
+            if (selected > 0) selected--;
+        } else if (ch == KEY_DOWN || ch == 14 || ch == 9) {         // Ctrl-N, Tab
+            if (selected + 1 < ntop) selected++;
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if (qlen > 0) query[--qlen] = '\0';
+            selected = 0;
+        } else if (ch == 21) {                              // Ctrl-U
+            qlen = 0;
+            query[0] = '\0';
+            selected = 0;
+        } else if (ch >= 32 && ch < 127 && qlen + 1 < (int)sizeof(query)) {
+            query[qlen++] = (char)tolower(ch);
+            query[qlen] = '\0';
+            selected = 0;
         }
-        return 0;
     }
+    curs_set(0);
+    frecency_free(&fr);
+    clear();
+    return chosen;
+}
 
-    char qcwd[QUOTE_BUF_SIZE];
-    shell_quote_single(qcwd, sizeof(qcwd), list->cwd);
-
-    // Quote the tool path — safe interpolation regardless of future changes
-    char qfz[QUOTE_BUF_SIZE];
-    shell_quote_single(qfz, sizeof(qfz), fz);
-    if (qfz[0] == '\0') return -1;
-
-    const int is_ff = (strcmp(fz, "ff") == 0);
-
-    char cmd[8192];
-    int ret;
-    if (is_ff) {
-        // ff does not accept fzf-style UI flags
-        ret = snprintf(cmd, sizeof(cmd),
-                 "cd %s && "
-                 "find . -maxdepth 5 -mindepth 1 2>/dev/null | "
-                 "sed 's#^\\./##' | "
-                 "%s",
-                 qcwd, qfz);
-    } else {
-        ret = snprintf(cmd, sizeof(cmd),
-                 "cd %s && "
-                 "find . -maxdepth 5 -mindepth 1 2>/dev/null | "
-                 "sed 's#^\\./##' | "
-                 "%s --prompt='Search> ' --height=40%% --reverse",
-                 qcwd, qfz);
+// `goto <query>`: the best existing directory for the words of the query
+// (matched in order, as one fuzzy pattern), other than the current one.
+static int jump_best(const char *const *words, int nwords, char *out, size_t out_len) {
+    char q[256];
+    int qlen = 0;
+    for (int i = 0; i < nwords; i++) {
+        for (const char *p = words[i]; *p && qlen + 1 < (int)sizeof(q); p++) q[qlen++] = (char)tolower((unsigned char)*p);
     }
-    if (ret < 0 || ret >= (int)sizeof(cmd)) return -1;
-
-    FILE *p = popen(cmd, "r");
-    if (!p) return -1;
-
-    char buf[MAX_PATH] = {0};
-    if (!fgets(buf, sizeof(buf), p)) { pclose(p); return 0; }
-    pclose(p);
-
-    buf[strcspn(buf, "\r\n")] = '\0';
-    if (buf[0] == '\0') return 0;
-
-    strncpy(out, buf, out_len - 1);
-    out[out_len - 1] = '\0';
-    return 1;
+    q[qlen] = '\0';
+    Frecency fr = {0};
+    if (frecency_load(&fr) != 0) return -1;
+    char cwd[MAX_PATH];
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+    static uint32_t top[FRECENCY_TOP_MAX];
+    int ntop = jump_match(&fr, q, qlen, cwd, top, FRECENCY_TOP_MAX);
+    int found = 0;
+    for (int i = 0; i < ntop && !found; i++) {
+        const char *s = path_at(&fr.paths, (int)top[i]);
+        struct stat st;
+        if (stat(s, &st) == 0 && S_ISDIR(st.st_mode)) {
+            snprintf(out, out_len, "%s", s);
+            found = 1;
+        }
+    }
+    frecency_free(&fr);
+    return found;
 }
 
 static void apply_sort_command(FileList *list, int cmd) {
@@ -701,10 +6125,15 @@ static void apply_sort_command(FileList *list, int cmd) {
         case 's': list->sort_mode = SORT_SIZE; break;
         case 't': list->sort_mode = SORT_TIME; break;
         case 'e': list->sort_mode = SORT_EXT;  break;
-        case 'r': list->sort_reverse = !list->sort_reverse; break;
-        default: break;
+        case 'd':
+            list->sort_mode = SORT_DU;
+            rebuild_view(list);
+            if (!list->loader) du_start(list);
+            return;
+        case 'r': reverse_view(list); return;
+        default: return;
     }
-    load_directory(list, list->cwd);
+    rebuild_view(list);
 }
 
 static void apply_filter_command(FileList *list, int cmd) {
@@ -712,35 +6141,81 @@ static void apply_filter_command(FileList *list, int cmd) {
         case 'f':
             list->filter_mode = FILTER_FILES;
             list->filter_text[0] = '\0';
-            load_directory(list, list->cwd);
+            rebuild_view(list);
             break;
         case 'd':
             list->filter_mode = FILTER_DIRS;
             list->filter_text[0] = '\0';
-            load_directory(list, list->cwd);
+            rebuild_view(list);
             break;
         case 'F':
             list->filter_mode = FILTER_ALL;
             list->filter_text[0] = '\0';
-            load_directory(list, list->cwd);
+            rebuild_view(list);
             break;
-        case 'c': {
-            char s[256];
-            if (popup_prompt(s, sizeof(s), "Filter (contains)", "Substring to match (empty clears):")) {
+        case 'c':
+            // Live filter: filter_input() takes the keys from here on.
+            // An empty substring shows what FILTER_ALL shows, so only the
+            // files/dirs filters need the rows rebuilt.
+            list->filter_typing = 1;
+            if (list->filter_mode != FILTER_CONTAINS) {
+                int rebuild = (list->filter_mode != FILTER_ALL);
                 list->filter_mode = FILTER_CONTAINS;
-                strncpy(list->filter_text, s, sizeof(list->filter_text) - 1);
-                list->filter_text[sizeof(list->filter_text) - 1] = '\0';
-            } else {
-                list->filter_mode = FILTER_ALL;
                 list->filter_text[0] = '\0';
+                if (rebuild) rebuild_view(list);
             }
-            load_directory(list, list->cwd);
             break;
-        }
         default: break;
     }
 }
 
+// A key while the live filter is open. Typing narrows the rows, backspace
+// and Ctrl-U widen them again, Enter keeps the filter and ESC drops it;
+// the arrows still move the cursor.
+static void filter_input(FileList *list, int ch) {
+    size_t len = strlen(list->filter_text);
+    switch (ch) {
+        case 27:
+            list->filter_typing = 0;
+            list->filter_mode = FILTER_ALL;
+            list->filter_text[0] = '\0';
+            if (len > 0) filter_widen(list, (int)len);
+            break;
+        case '\n':
+        case KEY_ENTER:
+            list->filter_typing = 0;
+            if (len == 0) list->filter_mode = FILTER_ALL;
+            filter_levels_drop(list);
+            break;
+        case KEY_BACKSPACE:
+        case 127:
+        case 8:
+            if (len == 0) break;
+            list->filter_text[len - 1] = '\0';
+            filter_widen(list, 1);
+            break;
+        case 21:   // Ctrl-U
+            if (len == 0) break;
+            list->filter_text[0] = '\0';
+            filter_widen(list, (int)len);
+            break;
+        case KEY_DOWN:
+            if (list->selected < list->count - 1) list->selected++;
+            scroll_to_selected(list, getmaxy(stdscr) - 3);
+            break;
+        case KEY_UP:
+            if (list->selected > 0) list->selected--;
+            scroll_to_selected(list, getmaxy(stdscr) - 3);
+            break;
+        default:
+            if (ch < 32 || ch >= 127 || len + 1 >= sizeof(list->filter_text)) break;
+            list->filter_text[len] = (char)ch;
+            list->filter_text[len + 1] = '\0';
+            filter_narrow(list);
+            break;
+    }
+}
+
 static void shell_quote_single(char *out, size_t out_len, const char *in) {
     if (!out || out_len < 3 || !in) { if (out && out_len > 0) out[0] = '\0'; return; }
     size_t j = 0;
@@ -874,16 +6349,19 @@ static int validate_editor(const char *editor) {
 static int open_selected_with_tmux_tree(FileList *list, const char *filetree_cmd,
                                         const char *editor_env, const char *editor_fallback) {
     if (list->selected >= list->count) return -1;
-    FileItem *item = &list->items[list->selected];
-    if (item->is_dir) { popup_message("Nope", "That is a directory. Use 'l' to enter it."); return 0; }
-    if (strcmp(item->name, ".") == 0 || strcmp(item->name, "..") == 0) {
+    uint32_t item = row_entry(list, list->selected);
+    const char *name = entry_name(&list->entries, item);
+    if (list->entries.is_dir[item]) { popup_message("Nope", "That is a directory. Use 'l' to enter it."); return 0; }
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
         popup_message("Nope", "Refusing to open '.' or '..'."); return 0;
     }
+    char full_path[MAX_PATH];
+    if (entry_full_path(list, item, full_path, sizeof(full_path)) != 0) return -1;
     const char *editor = getenv(editor_env);
     if (!editor || !*editor) editor = editor_fallback;
     if (!validate_editor(editor)) { popup_message("Error", "Invalid editor command"); return -1; }
     char qpath[QUOTE_BUF_SIZE];
-    shell_quote_single(qpath, sizeof(qpath), item->full_path);
+    shell_quote_single(qpath, sizeof(qpath), full_path);
     if (qpath[0] == '\0') return -1;
     if (!in_tmux()) {
         char cmd[8192];
@@ -913,16 +6391,19 @@ static int open_selected_with_tmux_tree(FileList *list, const char *filetree_cmd
 
 static int open_selected_with(FileList *list, const char *envvar, const char *fallback_cmd) {
     if (list->selected >= list->count) return -1;
-    FileItem *item = &list->items[list->selected];
-    if (item->is_dir) { popup_message("Nope", "That is a directory. Use 'l' to enter it."); return 0; }
-    if (strcmp(item->name, ".") == 0 || strcmp(item->name, "..") == 0) {
+    uint32_t item = row_entry(list, list->selected);
+    const char *name = entry_name(&list->entries, item);
+    if (list->entries.is_dir[item]) { popup_message("Nope", "That is a directory. Use 'l' to enter it."); return 0; }
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
         popup_message("Nope", "Refusing to open '.' or '.'."); return 0;
     }
+    char full_path[MAX_PATH];
+    if (entry_full_path(list, item, full_path, sizeof(full_path)) != 0) return -1;
     const char *tool = getenv(envvar);
     if (!tool || !*tool) tool = fallback_cmd;
     if (!validate_editor(tool)) { popup_message("Error", "Invalid tool command"); return -1; }
     char qpath[QUOTE_BUF_SIZE];
-    shell_quote_single(qpath, sizeof(qpath), item->full_path);
+    shell_quote_single(qpath, sizeof(qpath), full_path);
     if (qpath[0] == '\0') return -1;
     char cmd[8192];
     int ret = snprintf(cmd, sizeof(cmd), "%s %s", tool, qpath);
@@ -938,21 +6419,24 @@ static int open_selected_with(FileList *list, const char *envvar, const char *fa
 
 static int open_with_right_split(FileList *list, const char *envvar, const char *fallback_cmd) {
     if (list->selected >= list->count) return -1;
-    FileItem *item = &list->items[list->selected];
-    if (item->is_dir) { popup_message("Nope", "That is a directory. Use 'l' to enter it."); return 0; }
-    if (strcmp(item->name, ".") == 0 || strcmp(item->name, "..") == 0) {
+    uint32_t item = row_entry(list, list->selected);
+    const char *name = entry_name(&list->entries, item);
+    if (list->entries.is_dir[item]) { popup_message("Nope", "That is a directory. Use 'l' to enter it."); return 0; }
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
         popup_message("Nope", "Refusing to open '.' or '.'."); return 0;
     }
+    char full_path[MAX_PATH];
+    if (entry_full_path(list, item, full_path, sizeof(full_path)) != 0) return -1;
     if (!in_tmux()) return open_selected_with(list, envvar, fallback_cmd);
     const char *tool = getenv(envvar);
     if (!tool || !*tool) tool = fallback_cmd;
     if (!validate_editor(tool)) { popup_message("Error", "Invalid tool command"); return -1; }
     char qpath[QUOTE_BUF_SIZE], qcwd[QUOTE_BUF_SIZE];
-    shell_quote_single(qpath, sizeof(qpath), item->full_path);
+    shell_quote_single(qpath, sizeof(qpath), full_path);
     shell_quote_single(qcwd,  sizeof(qcwd),  list->cwd);
     if (qpath[0] == '\0' || qcwd[0] == '\0') return -1;
 char inner[8192];
-int r = snprintf(inner, sizeof(inner), "%s %s; tmux kill-pane", tool, item->full_path);    
+int r = snprintf(inner, sizeof(inner), "%s %s; tmux kill-pane", tool, full_path);    
 if (r < 0 || r >= (int)sizeof(inner)) return -1;
     char qinner[QUOTE_BUF_SIZE * 2];
     shell_quote_single(qinner, sizeof(qinner), inner);
@@ -1001,8 +6485,10 @@ static void cmd_show_help(void) {
     fprintf(help_file, "bs / BACKSPACE  | Go to parent directory\n");
     fprintf(help_file, "g               | Jump to top\n");
     fprintf(help_file, "G               | Jump to bottom\n");
-    fprintf(help_file, "/               | Fuzzy search files (ff/fzf)\n");
-    fprintf(help_file, "?               | Grep search in selected file (ff + nl)\n");
+    fprintf(help_file, "z               | Jump to a visited directory (frecency + fuzzy)\n");
+    fprintf(help_file, "/               | Fuzzy search files under cwd\n");
+    fprintf(help_file, "?               | Search in selected file (Ctrl-R: regex), open at line\n");
+    fprintf(help_file, "F               | Search file contents under cwd (Enter runs, ESC stops)\n");
     fprintf(help_file, "o               | Set current dir and quit (for shell integration)\n");
     fprintf(help_file, "\n");
     fprintf(help_file, "=== FILE OPERATIONS ===\n");
@@ -1022,16 +6508,19 @@ static void cmd_show_help(void) {
     fprintf(help_file, "ss              | Sort by size\n");
     fprintf(help_file, "st              | Sort by time\n");
     fprintf(help_file, "se              | Sort by extension\n");
+    fprintf(help_file, "sd              | Sort by disk usage (directories: recursive)\n");
     fprintf(help_file, "sr              | Reverse sort order\n");
     fprintf(help_file, "\n");
     fprintf(help_file, "=== FILTER ===\n");
     fprintf(help_file, "ff              | Filter: files only\n");
     fprintf(help_file, "fd              | Filter: directories only\n");
     fprintf(help_file, "fF              | Filter: show all (clear filter)\n");
-    fprintf(help_file, "fc              | Filter: contains substring (prompt)\n");
+    fprintf(help_file, "fc              | Filter: contains substring, live (Enter keeps, ESC clears)\n");
     fprintf(help_file, "\n");
     fprintf(help_file, "=== SETTINGS ===\n");
     fprintf(help_file, "h               | Toggle hidden files\n");
+    fprintf(help_file, "I               | Toggle ignored paths in / and F (.gitignore, .ignore, VCS dirs)\n");
+    fprintf(help_file, "i               | Toggle preview pane (file head, hex for binaries, directory contents)\n");
     fprintf(help_file, "\n");
     fprintf(help_file, "=== OTHER ===\n");
     fprintf(help_file, "q               | Quit\n");
@@ -1071,12 +6560,69 @@ static void cmd_show_help(void) {
     unlink(help_template);
 }
 
+// Open path in $EDITOR at the given line (the `?` and `F` results).
+static void edit_at_line(FileList *list, const char *path, int line) {
+    const char *editor = getenv("EDITOR");
+    if (!editor || !*editor) editor = "vi";
+    if (!validate_editor(editor)) {
+        popup_message("Error", "Invalid EDITOR environment variable");
+        return;
+    }
+    char qpath[QUOTE_BUF_SIZE];
+    shell_quote_single(qpath, sizeof(qpath), path);
+    if (qpath[0] == '\0') return;
+    char ecmd[8192];
+    int ret = snprintf(ecmd, sizeof(ecmd), "%s +%d %s", editor, line, qpath);
+    if (ret < 0 || ret >= (int)sizeof(ecmd)) return;
+    run_viewer_command(ecmd);
+    load_directory(list, list->cwd);
+}
+
+// Move the cursor by delta rows, clamped to the list, scrolling just
+// enough to keep it visible.
+static void move_selection(FileList *list, int delta, int visible_lines) {
+    if (list->count == 0) return;
+    int sel = list->selected + delta;
+    if (sel < 0) sel = 0;
+    if (sel > list->count - 1) sel = list->count - 1;
+    list->selected = sel;
+    if (sel < list->scroll_offset) list->scroll_offset = sel;
+    else if (visible_lines > 0 && sel >= list->scroll_offset + visible_lines)
+        list->scroll_offset = sel - visible_lines + 1;
+}
+
+static int motion_delta(int ch) {
+    switch (ch) {
+        case 'j': case KEY_DOWN: return 1;
+        case 'k': case KEY_UP:   return -1;
+        default: return 0;
+    }
+}
+
+// Keys that only move the cursor or change what the list shows.
+static int keeps_screen(int ch) {
+    switch (ch) {
+        case 'j': case 'k': case 'g': case 'G': case 'h': case 'I':
+        case KEY_UP: case KEY_DOWN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
 void handle_input(FileList *list, int *running) {
     int ch = getch();
+    if (ch == ERR) return;   // input timeout: background work wants a redraw
+    list->pending_select[0] = '\0';
+    // Anything but moving around may draw over the list (prompts, overlays,
+    // other programs), so the next frame starts from a clean screen.
+    if (!list->filter_typing && !list->pending_prefix && !keeps_screen(ch)) list->repaint = 1;
     int max_y, max_x;
     getmaxyx(stdscr, max_y, max_x);
     int visible_lines = max_y - 3;
 
+    if (list->filter_typing) { filter_input(list, ch); return; }
+
     if (list->pending_prefix) {
         char prefix = list->pending_prefix;
         list->pending_prefix = 0;
@@ -1092,23 +6638,46 @@ void handle_input(FileList *list, int *running) {
 
         case '?': {
             int line = 0;
-            int ok = ff_grep_selected_file(list, &line);
-            if (ok > 0) {
-                const char *editor = getenv("EDITOR");
-                if (!editor || !*editor) editor = "vi";
-                if (!validate_editor(editor)) {
-                    popup_message("Error", "Invalid EDITOR environment variable");
-                    break;
-                }
-                FileItem *it = &list->items[list->selected];
-                char qpath[QUOTE_BUF_SIZE];
-                shell_quote_single(qpath, sizeof(qpath), it->full_path);
-                if (qpath[0] == '\0') break;
-                char ecmd[8192];
-                int ret = snprintf(ecmd, sizeof(ecmd), "%s +%d %s", editor, line, qpath);
-                if (ret < 0 || ret >= (int)sizeof(ecmd)) break;
-                run_viewer_command(ecmd);
-                load_directory(list, list->cwd);
+            int ok = file_search_select_line(list, &line);
+            if (ok < 0) {
+                char msg[256];
+                snprintf(msg, sizeof(msg), "Search failed: %s", strerror(errno));
+                popup_message("Error", msg);
+            } else if (ok > 0) {
+                char full_path[MAX_PATH];
+                if (entry_full_path(list, row_entry(list, list->selected),
+                                    full_path, sizeof(full_path)) != 0) break;
+                edit_at_line(list, full_path, line);
+            }
+            break;
+        }
+
+        case 'z': {
+            char dir[MAX_PATH];
+            int ok = jump_select_dir(list, dir, sizeof(dir));
+            if (ok < 0) {
+                char msg[256];
+                snprintf(msg, sizeof(msg), "Jump failed: %s", strerror(errno));
+                popup_message("Error", msg);
+            } else if (ok > 0 && load_directory(list, dir) != 0) {
+                popup_message("Error", "Cannot open directory");
+            }
+            break;
+        }
+
+        case 'F': {
+            char rel[MAX_PATH];
+            int line = 0;
+            int ok = grep_tree(list, rel, sizeof(rel), &line);
+            if (ok < 0) {
+                char msg[256];
+                snprintf(msg, sizeof(msg), "Search failed: %s", strerror(errno));
+                popup_message("Error", msg);
+            } else if (ok > 0) {
+                char full_path[MAX_PATH];
+                int ret = snprintf(full_path, sizeof(full_path), "%s/%s", list->cwd, rel);
+                if (ret < 0 || ret >= (int)sizeof(full_path)) break;
+                edit_at_line(list, full_path, line);
             }
             break;
         }
@@ -1146,13 +6715,21 @@ void handle_input(FileList *list, int *running) {
 
         case 'h':
             list->show_hidden = !list->show_hidden;
-            load_directory(list, list->cwd);
+            rebuild_view(list);
             break;
 
         case 'H':
             cmd_show_help();
             break;
 
+        case 'I':
+            list->show_ignored = !list->show_ignored;
+            break;
+
+        case 'i':
+            list->preview_on = !list->preview_on;
+            break;
+
         case 's':
             list->pending_prefix = 's';
             break;
@@ -1168,8 +6745,9 @@ void handle_input(FileList *list, int *running) {
                     char msg[256];
                     snprintf(msg, sizeof(msg), "Failed to create file: %s", strerror(errno));
                     popup_message("Error", msg);
+                } else {
+                    patch_entries(list, name, NULL, name);
                 }
-                load_directory(list, list->cwd);
             }
             break;
         }
@@ -1181,8 +6759,9 @@ void handle_input(FileList *list, int *running) {
                     char msg[256];
                     snprintf(msg, sizeof(msg), "Failed to create directory: %s", strerror(errno));
                     popup_message("Error", msg);
+                } else {
+                    patch_entries(list, name, NULL, name);
                 }
-                load_directory(list, list->cwd);
             }
             break;
         }
@@ -1190,20 +6769,24 @@ void handle_input(FileList *list, int *running) {
         case 'r':
         case 'R': {
             if (list->selected < list->count) {
-                FileItem *item = &list->items[list->selected];
-                if (strcmp(item->name, ".") == 0 || strcmp(item->name, "..") == 0) {
+                uint32_t item = row_entry(list, list->selected);
+                char name[256];
+                strncpy(name, entry_name(&list->entries, item), sizeof(name) - 1);
+                name[sizeof(name) - 1] = '\0';
+                if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
                     popup_message("Nope", "Refusing to rename '.' or '..'.");
                     break;
                 }
                 char newname[256], label[512];
-                snprintf(label, sizeof(label), "Rename '%s' to:", item->name);
+                snprintf(label, sizeof(label), "Rename '%s' to:", name);
                 if (popup_prompt(newname, sizeof(newname), "Rename", label)) {
-                    if (rename_item(item, newname) != 0) {
+                    if (rename_entry(list, item, newname) != 0) {
                         char msg[256];
                         snprintf(msg, sizeof(msg), "Rename failed: %s", strerror(errno));
                         popup_message("Error", msg);
+                    } else {
+                        patch_entries(list, name, newname, newname);
                     }
-                    load_directory(list, list->cwd);
                 }
             }
             break;
@@ -1212,24 +6795,26 @@ void handle_input(FileList *list, int *running) {
 case 'd':
 case 'D': {
     if (list->selected < list->count) {
-        FileItem *item = &list->items[list->selected];
-        if (strcmp(item->name, ".") == 0 || strcmp(item->name, "..") == 0) {
+        uint32_t item = row_entry(list, list->selected);
+        char name[256];
+        strncpy(name, entry_name(&list->entries, item), sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
             popup_message("Nope", "Refusing to delete '.' or '..'."); break;
         }
         char prompt[512];
-        snprintf(prompt, sizeof(prompt), "Delete '%s'? This cannot be undone.", item->name);
+        snprintf(prompt, sizeof(prompt), "Delete '%s'? This cannot be undone.", name);
         if (popup_confirm("Confirm Delete", prompt)) {
-            if (delete_item_shallow(item) != 0) {
+            if (delete_entry_shallow(list, item) != 0) {
                 char msg[256];
                 if (errno == ENOTEMPTY)
                     snprintf(msg, sizeof(msg), "Directory is not empty");
                 else
                     snprintf(msg, sizeof(msg), "Delete failed: %s", strerror(errno));
                 popup_message("Error", msg);
+            } else {
+                patch_entries(list, name, NULL, NULL);
             }
-            load_directory(list, list->cwd);
-            if (list->count == 0) list->selected = 0;
-            else if (list->selected >= list->count) list->selected = list->count - 1;
         }
     }
     break;
@@ -1237,12 +6822,12 @@ case 'D': {
         case '/': {
             char rel[MAX_PATH];
 
-            endwin();
             int ok = fuzzy_select_path(list, rel, sizeof(rel));
-            refresh();
-            clear();
-
-            if (ok > 0) {
+            if (ok < 0) {
+                char msg[256];
+                snprintf(msg, sizeof(msg), "Search failed: %s", strerror(errno));
+                popup_message("Error", msg);
+            } else if (ok > 0) {
                 char full[MAX_PATH];
                 int ret = snprintf(full, sizeof(full), "%s/%s", list->cwd, rel);
                 if (ret < 0 || ret >= (int)sizeof(full)) break;
@@ -1285,17 +6870,8 @@ case 'D': {
                         // Navigate to the directory that contains the file
                         load_directory(list, target_dir);
 
-                        // Find the basename in the freshly-loaded listing
-                        for (int i = 0; i < list->count; i++) {
-                            if (strcmp(list->items[i].name, basename) == 0) {
-                                list->selected = i;
-                                if (list->selected < list->scroll_offset)
-                                    list->scroll_offset = list->selected;
-                                if (list->selected >= list->scroll_offset + visible_lines)
-                                    list->scroll_offset = list->selected - visible_lines + 1;
-                                break;
-                            }
-                        }
+                        // Select the basename, now or once the loader reaches it
+                        select_entry_by_name(list, basename);
                     }
                 }
             }
@@ -1304,6 +6880,7 @@ case 'D': {
 
         case 'o':
         case 'O': {
+            frecency_visit(list->cwd, FRECENCY_EXIT);
             write_goto_path(list->cwd);
             *running = 0;
             break;
@@ -1311,18 +6888,12 @@ case 'D': {
 
         case 'j':
         case KEY_DOWN:
-            if (list->selected < list->count - 1) {
-                list->selected++;
-                if (list->selected >= list->scroll_offset + visible_lines) list->scroll_offset++;
-            }
+            move_selection(list, 1, visible_lines);
             break;
 
         case 'k':
         case KEY_UP:
-            if (list->selected > 0) {
-                list->selected--;
-                if (list->selected < list->scroll_offset) list->scroll_offset--;
-            }
+            move_selection(list, -1, visible_lines);
             break;
 
         case 'g':
@@ -1342,8 +6913,11 @@ case 'D': {
         case KEY_ENTER:
         case 'l':
             if (list->selected < list->count) {
-                FileItem *item = &list->items[list->selected];
-                if (item->is_dir) load_directory(list, item->full_path);
+                uint32_t item = row_entry(list, list->selected);
+                char full_path[MAX_PATH];
+                if (list->entries.is_dir[item] &&
+                    entry_full_path(list, item, full_path, sizeof(full_path)) == 0)
+                    load_directory(list, full_path);
             }
             break;
 
@@ -1353,12 +6927,19 @@ case 'D': {
             strncpy(parent, list->cwd, MAX_PATH - 1);
             parent[MAX_PATH - 1] = '\0';
             char *last_slash = strrchr(parent, '/');
-            if (last_slash && last_slash != parent) {
+            if (!last_slash || last_slash[1] == '\0') break;
+            // Land the cursor on the directory we just left.
+            char child[256];
+            strncpy(child, last_slash + 1, sizeof(child) - 1);
+            child[sizeof(child) - 1] = '\0';
+            int rc;
+            if (last_slash != parent) {
                 *last_slash = '\0';
-                load_directory(list, parent);
-            } else if (last_slash == parent) {
-                load_directory(list, "/");
+                rc = load_directory(list, parent);
+            } else {
+                rc = load_directory(list, "/");
             }
+            if (rc == 0) select_entry_by_name(list, child);
             break;
         }
 
@@ -1367,6 +6948,49 @@ case 'D': {
     }
 }
 
+// Handle every key that is already waiting before drawing again, so key
+// repeat or a burst over a slow link costs one frame instead of one per
+// key. Runs of j/k fold into one cursor move per direction. A key that may open a
+// prompt or overlay is left for the next round, so it draws over an
+// up-to-date list. While frames come closer than FRAME_MS apart, the rest
+// of the gap is spent collecting more keys.
+static void read_input(FileList *list, int *running) {
+    int handled = 0;
+    int delta = 0;
+    while (*running) {
+        int ch = getch();
+        if (ch == ERR) {
+            if (!handled && !delta) break;
+            double left = FRAME_MS - elapsed_ms(&list->drawn);
+            if (left <= 0) break;
+            struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+            if (poll(&pfd, 1, (int)left + 1) <= 0) break;
+            continue;
+        }
+        int typing = list->filter_typing || list->pending_prefix;
+        int d = typing ? 0 : motion_delta(ch);
+        // A run in one direction moves like the single steps it replaces;
+        // turning around settles the run first so scrolling matches too.
+        if (d && (delta == 0 || (d > 0) == (delta > 0))) { delta += d; continue; }
+        if (delta) {
+            list->pending_select[0] = '\0';
+            move_selection(list, delta, LINES - 3);
+            delta = 0;
+            handled = 1;
+        }
+        if (d) { delta = d; continue; }
+        if (handled && !typing && !keeps_screen(ch)) { ungetch(ch); break; }
+        ungetch(ch);
+        handle_input(list, running);
+        handled = 1;
+        if (list->repaint) break;
+    }
+    if (delta) {
+        list->pending_select[0] = '\0';
+        move_selection(list, delta, LINES - 3);
+    }
+}
+
 static void expand_tilde(char *out, size_t out_len, const char *in) {
     if (!out || out_len == 0 || !in) return;
     if (in[0] == '~' && (in[1] == '\0' || in[1] == '/')) {
@@ -1385,7 +7009,17 @@ int main(int argc, char **argv) {
     FileList list = (FileList){0};
     char start[MAX_PATH];
 
+    list.dir_fd = -1;
+    list.watch_wd = -1;
+#ifdef __linux__
+    list.watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    list.watch_fd = -1;
+#endif
+    const char *env_lazy = getenv("GOTO_LAZY_STAT");
+    list.lazy_meta = (env_lazy && *env_lazy && strcmp(env_lazy, "0") != 0);
     list.show_hidden = 0;
+    list.show_ignored = 0;
     list.sort_mode = SORT_NAME;
     list.sort_reverse = 0;
     list.filter_mode = FILTER_ALL;
@@ -1411,6 +7045,20 @@ int main(int argc, char **argv) {
     if (argc > 1 && argv[1] && argv[1][0]) {
         char tmp[MAX_PATH];
         expand_tilde(tmp, sizeof(tmp), argv[1]);
+        struct stat st;
+        if (stat(tmp, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            // Not a directory: jump straight to the best visited match.
+            char best[MAX_PATH];
+            if (jump_best((const char *const *)argv + 1, argc - 1, best, sizeof(best)) <= 0) {
+                fprintf(stderr, "goto: no visited directory matches '%s'\n", argv[1]);
+                return 1;
+            }
+            frecency_visit(best, FRECENCY_EXIT);
+            write_goto_path(best);
+            printf("%s\n", best);
+            frecency_finish();
+            return 0;
+        }
         char resolved[MAX_PATH];
         if (realpath(tmp, resolved)) {
             strncpy(start, resolved, sizeof(start) - 1);
@@ -1425,6 +7073,8 @@ int main(int argc, char **argv) {
     cbreak();
     noecho();
     keypad(stdscr, TRUE);
+    idlok(stdscr, TRUE);  // lets draw_ui scroll rows with the terminal's scroll region
+    set_escdelay(25);    // ESC closes the finder and prompts, do not wait a second for it
     curs_set(0);
 
     if (has_colors()) {
@@ -1439,6 +7089,7 @@ int main(int argc, char **argv) {
         init_pair(7, COLOR_RED,     -1);
         init_pair(8, COLOR_WHITE,   -1);
     }
+    paint_init();
 
     if (load_directory(&list, start) != 0) {
         endwin();
@@ -1448,12 +7099,25 @@ int main(int argc, char **argv) {
     }
 
     int running = 1;
+    nodelay(stdscr, TRUE);
     while (running) {
+        loader_pump(&list);
+        sort_pump(&list);
+        watch_pump(&list);
+        du_pump(&list);
+        prefetch_pump(&list);
+        preview_pump(&list);
         draw_ui(&list);
-        handle_input(&list, &running);
+        wait_for_event(&list);
+        read_input(&list, &running);
     }
 
     endwin();
+    frecency_finish();
+    list_free(&list);
+    listing_cache_free();
+    preview_cache_free();
+    du_memo_free();
 
     for (int i = 0; i < g_temp_file_count; i++) {
         if (g_temp_files[i][0] != '\0') unlink(g_temp_files[i]);